@@ -1,512 +1,4270 @@
 ////////////////////////////////////////////////////////////////////////////////
 // Headers
 ////////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <atomic>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
 
 #include "RichText.hpp"
 
 #include <SFML/Graphics/Font.hpp>
+#include <SFML/Graphics/Image.hpp>
 #include <SFML/Graphics/Rect.hpp>
 #include <SFML/Graphics/RenderTarget.hpp>
+#include <SFML/Graphics/Shader.hpp>
+#include <SFML/Graphics/View.hpp>
 
+#include <SFML/System/Err.hpp>
 #include <SFML/System/String.hpp>
+#include <SFML/System/Utf.hpp>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Instrumentation, compiled out unless SFE_RICHTEXT_STATS is defined
+////////////////////////////////////////////////////////////////////////////////
+#ifdef SFE_RICHTEXT_STATS
+#define SFE_RICHTEXT_COUNT(counter, count) ((counter) += (count))
+#define SFE_RICHTEXT_PROFILE(scope) ProfileScope profileScope(scope)
+#else
+#define SFE_RICHTEXT_COUNT(counter, count) ((void)0)
+#define SFE_RICHTEXT_PROFILE(scope) ((void)0)
+#endif
+
+namespace
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Function called at the end of profiled scopes
+////////////////////////////////////////////////////////////////////////////////
+std::atomic<sfe::RichText::ProfileCallback> profileCallback(nullptr);
+
+#ifdef SFE_RICHTEXT_STATS
+
+////////////////////////////////////////////////////////////////////////////////
+// Time a scope, if a profile callback is set when it starts
+////////////////////////////////////////////////////////////////////////////////
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char *scope)
+        : m_scope(scope),
+          m_callback(profileCallback.load(std::memory_order_relaxed))
+    {
+        if (m_callback)
+            m_start = std::chrono::steady_clock::now();
+    }
+
+    ~ProfileScope()
+    {
+        if (m_callback)
+            m_callback(m_scope, std::chrono::steady_clock::now() - m_start);
+    }
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator =(const ProfileScope &) = delete;
+
+private:
+    const char *m_scope;                                ///< Name of the scope
+    sfe::RichText::ProfileCallback m_callback;          ///< Function to call at the end
+    std::chrono::steady_clock::time_point m_start;      ///< Start of the scope
+};
+
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Add the work counted by a line or a text to a total
+////////////////////////////////////////////////////////////////////////////////
+void addStats(sfe::RichTextStats &total, const sfe::RichTextStats &stats)
+{
+    total.textLayouts += stats.textLayouts;
+    total.lineLayouts += stats.lineLayouts;
+    total.runSplits += stats.runSplits;
+    total.runsCreated += stats.runsCreated;
+    total.runsDestroyed += stats.runsDestroyed;
+    total.drawCalls += stats.drawCalls;
+    total.verticesDrawn += stats.verticesDrawn;
+    total.bytesHeld += stats.bytesHeld;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Add an underline or strikethrough line to the vertex array
+////////////////////////////////////////////////////////////////////////////////
+void addLine(std::pmr::vector<sf::Vertex> &vertices, float left, float right, float lineTop,
+             const sf::Color &color, float offset, float thickness,
+             float outlineThickness = 0.f)
+{
+    float top = std::floor(lineTop + offset - (thickness / 2.f) + 0.5f);
+    float bottom = top + std::floor(thickness + 0.5f);
+
+    left -= outlineThickness;
+    right += outlineThickness;
+    top -= outlineThickness;
+    bottom += outlineThickness;
+
+    vertices.push_back(sf::Vertex(sf::Vector2f(left, top), color, sf::Vector2f(1.f, 1.f)));
+    vertices.push_back(sf::Vertex(sf::Vector2f(right, top), color, sf::Vector2f(1.f, 1.f)));
+    vertices.push_back(sf::Vertex(sf::Vector2f(left, bottom), color, sf::Vector2f(1.f, 1.f)));
+    vertices.push_back(sf::Vertex(sf::Vector2f(left, bottom), color, sf::Vector2f(1.f, 1.f)));
+    vertices.push_back(sf::Vertex(sf::Vector2f(right, top), color, sf::Vector2f(1.f, 1.f)));
+    vertices.push_back(sf::Vertex(sf::Vector2f(right, bottom), color, sf::Vector2f(1.f, 1.f)));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Add a glyph quad to the vertex array
+////////////////////////////////////////////////////////////////////////////////
+void addGlyphQuad(std::pmr::vector<sf::Vertex> &vertices, sf::Vector2f position,
+                  const sf::Color &color, const sf::Glyph &glyph, float italic,
+                  float outlineThickness = 0.f)
+{
+    float left = glyph.bounds.left - outlineThickness;
+    float top = glyph.bounds.top - outlineThickness;
+    float right = glyph.bounds.left + glyph.bounds.width - outlineThickness;
+    float bottom = glyph.bounds.top + glyph.bounds.height - outlineThickness;
+
+    float u1 = static_cast<float>(glyph.textureRect.left);
+    float v1 = static_cast<float>(glyph.textureRect.top);
+    float u2 = static_cast<float>(glyph.textureRect.left + glyph.textureRect.width);
+    float v2 = static_cast<float>(glyph.textureRect.top + glyph.textureRect.height);
+
+    vertices.push_back(sf::Vertex(sf::Vector2f(position.x + left - italic * top, position.y + top), color, sf::Vector2f(u1, v1)));
+    vertices.push_back(sf::Vertex(sf::Vector2f(position.x + right - italic * top, position.y + top), color, sf::Vector2f(u2, v1)));
+    vertices.push_back(sf::Vertex(sf::Vector2f(position.x + left - italic * bottom, position.y + bottom), color, sf::Vector2f(u1, v2)));
+    vertices.push_back(sf::Vertex(sf::Vector2f(position.x + left - italic * bottom, position.y + bottom), color, sf::Vector2f(u1, v2)));
+    vertices.push_back(sf::Vertex(sf::Vector2f(position.x + right - italic * top, position.y + top), color, sf::Vector2f(u2, v1)));
+    vertices.push_back(sf::Vertex(sf::Vector2f(position.x + right - italic * bottom, position.y + bottom), color, sf::Vector2f(u2, v2)));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Check whether two runs can be merged into one
+////////////////////////////////////////////////////////////////////////////////
+bool haveSameAttributes(const sfe::RichText::Line::Run &a,
+                        const sfe::RichText::Line::Run &b)
+{
+    return a.stroke.fill == b.stroke.fill
+        && a.stroke.outline == b.stroke.outline
+        && a.stroke.thickness == b.stroke.thickness
+        && a.style == b.style;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Update a list of line indices after the lines in [first, first + removed)
+// were replaced by added other ones. Indices of removed lines are forgotten.
+////////////////////////////////////////////////////////////////////////////////
+void replaceLines(std::pmr::vector<std::size_t> &lines, std::size_t first,
+                  std::size_t removed, std::size_t added)
+{
+    std::size_t kept = 0;
+    for (std::size_t line : lines)
+    {
+        if (line < first)
+            lines[kept++] = line;
+        else if (line >= first + removed)
+            lines[kept++] = line - removed + added;
+    }
+    lines.resize(kept);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Line heights are summed in a Fenwick tree: node i, from 1, holds the sum
+// of the heights in [i - lowbit(i), i). Heights are floats, so their sums
+// as doubles are exact, whatever order they are added in.
+////////////////////////////////////////////////////////////////////////////////
+void buildHeightTree(std::pmr::vector<double> &tree, const std::pmr::vector<float> &heights)
+{
+    tree.assign(heights.size() + 1, 0.0);
+    for (std::size_t i = 1; i < tree.size(); ++i)
+    {
+        tree[i] += heights[i - 1];
+
+        std::size_t parent = i + (i & (0 - i));
+        if (parent < tree.size())
+            tree[parent] += tree[i];
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Get the sum of the first count heights
+////////////////////////////////////////////////////////////////////////////////
+double sumHeights(const std::pmr::vector<double> &tree, std::size_t count)
+{
+    double sum = 0.0;
+    for (; count > 0; count &= count - 1)
+        sum += tree[count];
+
+    return sum;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Add delta to a height
+////////////////////////////////////////////////////////////////////////////////
+void addHeight(std::pmr::vector<double> &tree, std::size_t index, double delta)
+{
+    for (std::size_t i = index + 1; i < tree.size(); i += i & (0 - i))
+        tree[i] += delta;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Add a height after the last one
+////////////////////////////////////////////////////////////////////////////////
+void pushHeight(std::pmr::vector<double> &tree, float height)
+{
+    if (tree.empty())
+        tree.push_back(0.0);
+
+    std::size_t i = tree.size();
+    tree.push_back(height + sumHeights(tree, i - 1) - sumHeights(tree, i - (i & (0 - i))));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Get the largest number of first heights whose sum is at most y
+////////////////////////////////////////////////////////////////////////////////
+std::size_t findHeight(const std::pmr::vector<double> &tree, double y)
+{
+    std::size_t step = 1;
+    while (step * 2 < tree.size())
+        step *= 2;
+
+    std::size_t count = 0;
+    for (; step > 0; step /= 2)
+    {
+        if (count + step < tree.size() && tree[count + step] <= y)
+        {
+            count += step;
+            y -= tree[count];
+        }
+    }
+
+    return count;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Parse a markup color: #rgb, #rrggbb, #rrggbbaa, or a color name
+////////////////////////////////////////////////////////////////////////////////
+bool parseColor(std::string_view string, sf::Color &color)
+{
+    static const std::pair<std::string_view, sf::Color> names[] = {
+        { "black", sf::Color::Black }, { "white", sf::Color::White },
+        { "red", sf::Color::Red }, { "green", sf::Color::Green },
+        { "blue", sf::Color::Blue }, { "yellow", sf::Color::Yellow },
+        { "magenta", sf::Color::Magenta }, { "cyan", sf::Color::Cyan },
+        { "transparent", sf::Color::Transparent }
+    };
+
+    if (string.empty() || string[0] != '#')
+    {
+        for (const auto &name : names)
+        {
+            if (name.first == string)
+            {
+                color = name.second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Read the hexadecimal digits
+    std::array<sf::Uint8, 8> digits;
+    string.remove_prefix(1);
+    if (string.size() != 3 && string.size() != 6 && string.size() != 8)
+        return false;
+
+    for (std::size_t i = 0; i < string.size(); ++i)
+    {
+        char c = string[i];
+        if (c >= '0' && c <= '9')
+            digits[i] = static_cast<sf::Uint8>(c - '0');
+        else if (c >= 'a' && c <= 'f')
+            digits[i] = static_cast<sf::Uint8>(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            digits[i] = static_cast<sf::Uint8>(c - 'A' + 10);
+        else
+            return false;
+    }
+
+    if (string.size() == 3)
+    {
+        color = sf::Color(digits[0] * 17, digits[1] * 17, digits[2] * 17);
+        return true;
+    }
+
+    color = sf::Color(digits[0] * 16 + digits[1], digits[2] * 16 + digits[3], digits[4] * 16 + digits[5]);
+    if (string.size() == 8)
+        color.a = digits[6] * 16 + digits[7];
+
+    return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Parse a markup number
+////////////////////////////////////////////////////////////////////////////////
+bool parseFloat(std::string_view string, float &value)
+{
+    // strtof needs a terminated string
+    char buffer[32];
+    if (string.empty() || string.size() >= sizeof(buffer))
+        return false;
+
+    std::memcpy(buffer, string.data(), string.size());
+    buffer[string.size()] = '\0';
+
+    char *end;
+    value = std::strtof(buffer, &end);
+    return end == buffer + string.size();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Parse markup in a single pass, calling addText(text, stroke, style) for the
+// text between tags and, if placeholders are enabled, addArgument(index,
+// stroke, style) for each {n}. Open tags are kept on a fixed size stack, so
+// that parsing doesn't allocate. Tags past its depth are kept as text.
+////////////////////////////////////////////////////////////////////////////////
+template <typename TextFunction, typename ArgumentFunction>
+void parseMarkup(std::string_view markup, bool placeholders,
+                 TextFunction addText, ArgumentFunction addArgument)
+{
+    enum Tag { Bold, Italic, Underlined, StrikeThrough, Color, OutlineColor, None };
+    static const std::string_view tagNames[] = { "b", "i", "u", "s", "color", "outline" };
+
+    struct State
+    {
+        Tag tag;
+        sfe::TextStroke stroke;
+        sf::Uint32 style;
+    };
+    std::array<State, 32> stack;
+    std::size_t depth = 0;
+
+    sfe::TextStroke stroke;
+    sf::Uint32 style = sf::Text::Regular;
+
+    auto flush = [&](std::size_t begin, std::size_t end)
+    {
+        if (begin < end)
+            addText(markup.substr(begin, end - begin), stroke, style);
+    };
+
+    // Apply a tag, or return false to keep it as text
+    auto applyTag = [&](std::string_view tag) -> bool
+    {
+        bool closing = !tag.empty() && tag[0] == '/';
+        if (closing)
+            tag.remove_prefix(1);
+
+        std::string_view argument;
+        std::size_t equal = tag.find('=');
+        if (equal != std::string_view::npos)
+        {
+            argument = tag.substr(equal + 1);
+            tag = tag.substr(0, equal);
+        }
+
+        Tag id = None;
+        for (int i = 0; i < None; ++i)
+        {
+            if (tagNames[i] == tag)
+                id = static_cast<Tag>(i);
+        }
+        if (id == None || ((closing || id < Color) && !argument.empty()))
+            return false;
+
+        // Go back to the state before the matching open tag
+        if (closing)
+        {
+            for (std::size_t i = depth; i > 0; --i)
+            {
+                if (stack[i - 1].tag == id)
+                {
+                    stroke = stack[i - 1].stroke;
+                    style = stack[i - 1].style;
+                    depth = i - 1;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        if (depth == stack.size())
+            return false;
+
+        sfe::TextStroke newStroke = stroke;
+        sf::Uint32 newStyle = style;
+        switch (id)
+        {
+        case Bold:          newStyle |= sf::Text::Bold; break;
+        case Italic:        newStyle |= sf::Text::Italic; break;
+        case Underlined:    newStyle |= sf::Text::Underlined; break;
+        case StrikeThrough: newStyle |= sf::Text::StrikeThrough; break;
+        case Color:
+            if (!parseColor(argument, newStroke.fill))
+                return false;
+            break;
+        case OutlineColor:
+        {
+            std::size_t comma = argument.find(',');
+            if (!parseColor(argument.substr(0, comma), newStroke.outline))
+                return false;
+            if (comma != std::string_view::npos && !parseFloat(argument.substr(comma + 1), newStroke.thickness))
+                return false;
+            if (newStroke.thickness == 0.f)
+                newStroke.thickness = 1.f;
+            break;
+        }
+        default:
+            break;
+        }
+
+        stack[depth++] = State{ id, stroke, style };
+        stroke = newStroke;
+        style = newStyle;
+        return true;
+    };
+
+    // Read a placeholder index, or return false to keep it as text
+    auto applyPlaceholder = [&](std::string_view tag) -> bool
+    {
+        if (tag.empty() || tag.size() > 9)
+            return false;
+
+        std::size_t index = 0;
+        for (char c : tag)
+        {
+            if (c < '0' || c > '9')
+                return false;
+            index = index * 10 + static_cast<std::size_t>(c - '0');
+        }
+
+        addArgument(index, stroke, style);
+        return true;
+    };
+
+    std::size_t textStart = 0;
+    std::size_t i = 0;
+    while (i < markup.size())
+    {
+        char open = markup[i];
+        if (open != '[' && !(placeholders && open == '{'))
+        {
+            ++i;
+            continue;
+        }
+
+        // A doubled bracket stands for itself
+        if (i + 1 < markup.size() && markup[i + 1] == open)
+        {
+            flush(textStart, i + 1);
+            i += 2;
+            textStart = i;
+            continue;
+        }
+
+        std::size_t close = markup.find(open == '[' ? ']' : '}', i + 1);
+        if (close == std::string_view::npos)
+            break;
+
+        // Flush the text before the tag changes the stroke or style
+        flush(textStart, i);
+        textStart = i;
+
+        std::string_view tag = markup.substr(i + 1, close - i - 1);
+        bool applied = open == '[' ? applyTag(tag) : applyPlaceholder(tag);
+        if (applied)
+        {
+            i = close + 1;
+            textStart = i;
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    flush(textStart, markup.size());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Metrics of a font at a character size. sf::Font looks glyphs up in a tree,
+// and asks FreeType for kerning and line spacing on every call, so the
+// values used by the layout are cached here, once for every text.
+// sf::Font isn't thread-safe, so every access to a font, and every change to
+// the cache, happens under an exclusive lock. Hits only take a shared lock.
+// Distance field text is laid out with the advances of the base size of its
+// atlas, scaled, so that no glyph is rasterised at the size of the text.
+////////////////////////////////////////////////////////////////////////////////
+class FontMetrics
+{
+public:
+    FontMetrics(const sf::Font &font, unsigned int characterSize, FontMetrics *base)
+        : m_font(font),
+          m_characterSize(characterSize),
+          m_lineSpacing(std::floor(font.getLineSpacing(characterSize))),
+          m_underlinePosition(font.getUnderlinePosition(characterSize)),
+          m_underlineThickness(font.getUnderlineThickness(characterSize)),
+          m_base(base),
+          m_scale(base ? static_cast<float>(characterSize) / base->m_characterSize : 1.f)
+    {
+
+    }
+
+    // Get the metrics of a font at a character size, shared by every text,
+    // with the advances of another size scaled if baseSize isn't 0
+    static FontMetrics &get(const sf::Font &font, unsigned int characterSize, unsigned int baseSize = 0)
+    {
+        if (baseSize == characterSize)
+            baseSize = 0;
+
+        std::map<std::tuple<const sf::Font *, unsigned int, unsigned int>, FontMetrics> &cache = getCache();
+        auto key = std::make_tuple(&font, characterSize, baseSize);
+
+        {
+            std::shared_lock<std::shared_mutex> lock(getMutex());
+            auto it = cache.find(key);
+            if (it != cache.end())
+                return it->second;
+        }
+
+        FontMetrics *base = baseSize ? &get(font, baseSize) : nullptr;
+
+        std::unique_lock<std::shared_mutex> lock(getMutex());
+        auto it = cache.find(key);
+        if (it == cache.end())
+            it = cache.emplace(key, FontMetrics(font, characterSize, base)).first;
+
+        return it->second;
+    }
+
+    // Forget the metrics of every font
+    static void clear()
+    {
+        std::unique_lock<std::shared_mutex> lock(getMutex());
+        getCache().clear();
+    }
+
+    const sf::Glyph &getGlyph(sf::Uint32 character, bool bold, float outlineThickness = 0.f)
+    {
+        std::uint32_t thicknessBits;
+        std::memcpy(&thicknessBits, &outlineThickness, sizeof(thicknessBits));
+        std::uint64_t key = (std::uint64_t(thicknessBits) << 32) | (std::uint64_t(bold) << 31) | character;
+
+        {
+            std::shared_lock<std::shared_mutex> lock(getMutex());
+            auto it = m_glyphs.find(key);
+            if (it != m_glyphs.end())
+                return it->second;
+        }
+
+        // Elements of an unordered_map don't move, so the reference stays
+        // valid after the lock is released
+        std::unique_lock<std::shared_mutex> lock(getMutex());
+        auto it = m_glyphs.find(key);
+        if (it == m_glyphs.end())
+            it = m_glyphs.emplace(key, m_font.getGlyph(character, m_characterSize, bold, outlineThickness)).first;
+
+        return it->second;
+    }
+
+    // Get the horizontal advance of a character, the same way sf::Text does
+    float getAdvance(sf::Uint32 character, bool bold)
+    {
+        if (m_base)
+            return m_base->getAdvance(character, bold) * m_scale;
+
+        if (character == L'\t')
+            return getGlyph(L' ', bold).advance * 4.f;
+
+        return getGlyph(character, bold).advance;
+    }
+
+    float getKerning(sf::Uint32 first, sf::Uint32 second)
+    {
+        if (first == 0)
+            return 0.f;
+
+        std::uint64_t key = (std::uint64_t(first) << 32) | second;
+
+        {
+            std::shared_lock<std::shared_mutex> lock(getMutex());
+            auto it = m_kernings.find(key);
+            if (it != m_kernings.end())
+                return it->second;
+        }
+
+        std::unique_lock<std::shared_mutex> lock(getMutex());
+        auto it = m_kernings.find(key);
+        if (it == m_kernings.end())
+            it = m_kernings.emplace(key, m_font.getKerning(first, second, m_characterSize)).first;
+
+        return it->second;
+    }
+
+    // Get the glyph atlas. sf::Font creates it on first use.
+    const sf::Texture &getTexture()
+    {
+        std::unique_lock<std::shared_mutex> lock(getMutex());
+        return m_font.getTexture(m_characterSize);
+    }
+
+    // Copy the glyph atlas, without another thread adding glyphs meanwhile
+    sf::Image copyTexture()
+    {
+        std::unique_lock<std::shared_mutex> lock(getMutex());
+        return m_font.getTexture(m_characterSize).copyToImage();
+    }
+
+    unsigned int getCharacterSize() const { return m_characterSize; }
+    float getLineSpacing() const { return m_lineSpacing; }
+    float getUnderlinePosition() const { return m_underlinePosition; }
+    float getUnderlineThickness() const { return m_underlineThickness; }
+
+private:
+    static std::map<std::tuple<const sf::Font *, unsigned int, unsigned int>, FontMetrics> &getCache()
+    {
+        static std::map<std::tuple<const sf::Font *, unsigned int, unsigned int>, FontMetrics> cache;
+        return cache;
+    }
+
+    static std::shared_mutex &getMutex()
+    {
+        static std::shared_mutex mutex;
+        return mutex;
+    }
+
+    const sf::Font &m_font;                                 ///< Font
+    unsigned int m_characterSize;                           ///< Character size
+    float m_lineSpacing;                                    ///< Line spacing, rounded down
+    float m_underlinePosition;                              ///< Underline offset from the baseline
+    float m_underlineThickness;                             ///< Underline thickness
+    std::unordered_map<std::uint64_t, sf::Glyph> m_glyphs;  ///< Glyphs by character, boldness and outline thickness
+    std::unordered_map<std::uint64_t, float> m_kernings;    ///< Kerning offsets by pair of characters
+    FontMetrics *m_base;                                    ///< Metrics whose advances are scaled, if any
+    float m_scale;                                          ///< Ratio of the character size to the base one
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Get the metrics a line is laid out with
+////////////////////////////////////////////////////////////////////////////////
+FontMetrics &getMetrics(const sf::Font &font, unsigned int characterSize,
+                        const sfe::DistanceFieldFont *distanceField)
+{
+    return FontMetrics::get(font, characterSize, distanceField ? distanceField->getBaseSize() : 0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Distance field shader. The outline level of a quad, in 64ths of the field,
+// is stored in its texture coordinates, as a multiple of DistanceFieldLevelStride
+// added to u, so that every outline thickness is drawn in the same call.
+// The shader hardcodes both constants.
+////////////////////////////////////////////////////////////////////////////////
+const int DistanceFieldLevelStride = 8192;
+const int DistanceFieldMaxLevel = 32;
+
+const char *const DistanceFieldVertexShader =
+    "varying float level;\n"
+    "void main()\n"
+    "{\n"
+    "    vec2 coords = gl_MultiTexCoord0.xy;\n"
+    "    level = floor(coords.x / 8192.0);\n"
+    "    coords.x -= level * 8192.0;\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;\n"
+    "    gl_TexCoord[0] = gl_TextureMatrix[0] * vec4(coords, 0.0, 1.0);\n"
+    "    gl_FrontColor = gl_Color;\n"
+    "}\n";
+
+const char *const DistanceFieldFragmentShader =
+    "uniform sampler2D atlas;\n"
+    "varying float level;\n"
+    "void main()\n"
+    "{\n"
+    "    float distance = texture2D(atlas, gl_TexCoord[0].xy).a;\n"
+    "    float edge = 0.5 - level / 64.0;\n"
+    "    float smoothing = max(fwidth(distance) * 0.75, 1.0 / 255.0);\n"
+    "    float alpha = smoothstep(edge - smoothing, edge + smoothing, distance);\n"
+    "    gl_FragColor = vec4(gl_Color.rgb, gl_Color.a * alpha);\n"
+    "}\n";
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Get the distance field shader, compiled on first use, null if unavailable
+////////////////////////////////////////////////////////////////////////////////
+const sf::Shader *getDistanceFieldShader()
+{
+    static sf::Shader shader;
+    static bool loaded = false;
+    static std::once_flag once;
+
+    std::call_once(once, []
+    {
+        loaded = sf::Shader::isAvailable() &&
+                 shader.loadFromMemory(DistanceFieldVertexShader, DistanceFieldFragmentShader);
+        if (loaded)
+            shader.setUniform("atlas", sf::Shader::CurrentTexture);
+    });
+
+    return loaded ? &shader : nullptr;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Set the texture, and the shader of distance field text, to draw glyphs with.
+// A shader given by the caller is kept, and decodes the field itself.
+////////////////////////////////////////////////////////////////////////////////
+void setGlyphStates(sf::RenderStates &states, const sf::Font &font, unsigned int characterSize,
+                    const sfe::DistanceFieldFont *distanceField)
+{
+    if (distanceField)
+    {
+        states.texture = &distanceField->getTexture();
+        if (!states.shader)
+            states.shader = getDistanceFieldShader();
+    }
+    else
+    {
+        states.texture = &FontMetrics::get(font, characterSize).getTexture();
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Squared distance transform of a row or column of a grid, in place
+// (Felzenszwalb and Huttenlocher)
+////////////////////////////////////////////////////////////////////////////////
+void transformDistances(float *grid, std::size_t offset, std::size_t stride, std::size_t length,
+                        float *f, float *z, std::size_t *v)
+{
+    for (std::size_t q = 0; q < length; ++q)
+        f[q] = grid[offset + q * stride];
+
+    // Lower envelope of the parabolas rooted at each cell
+    auto intersect = [f](std::size_t q, std::size_t r)
+    {
+        float fq = f[q] + static_cast<float>(q * q);
+        float fr = f[r] + static_cast<float>(r * r);
+        return (fq - fr) / (2.f * static_cast<float>(q - r));
+    };
+
+    std::size_t k = 0;
+    v[0] = 0;
+    z[0] = -1e20f;
+    z[1] = 1e20f;
+
+    for (std::size_t q = 1; q < length; ++q)
+    {
+        float s = intersect(q, v[k]);
+        while (s <= z[k])
+            s = intersect(q, v[--k]);
+
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = 1e20f;
+    }
+
+    k = 0;
+    for (std::size_t q = 0; q < length; ++q)
+    {
+        while (z[k + 1] < static_cast<float>(q))
+            ++k;
+
+        float d = static_cast<float>(q) - static_cast<float>(v[k]);
+        grid[offset + q * stride] = d * d + f[v[k]];
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Squared distance transform of a grid, in place
+////////////////////////////////////////////////////////////////////////////////
+void transformDistances(std::vector<float> &grid, std::size_t width, std::size_t height)
+{
+    std::size_t length = std::max(width, height);
+    std::vector<float> f(length);
+    std::vector<float> z(length + 1);
+    std::vector<std::size_t> v(length);
+
+    for (std::size_t x = 0; x < width; ++x)
+        transformDistances(grid.data(), x, width, height, f.data(), z.data(), v.data());
+    for (std::size_t y = 0; y < height; ++y)
+        transformDistances(grid.data(), y * width, 1, width, f.data(), z.data(), v.data());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Compute the distance field of a glyph of the font texture into the alpha
+// channel of the atlas. 0.5 is the edge, and the field falls to 0 and rises
+// to 1 spread pixels outside and inside of it. The coverage of antialiased
+// pixels places the edge between pixels, as in Mapbox's TinySDF.
+////////////////////////////////////////////////////////////////////////////////
+void renderDistanceField(const sf::Image &source, const sf::IntRect &sourceRect,
+                         std::vector<sf::Uint8> &pixels, unsigned int pixelsWidth,
+                         const sf::IntRect &rect, unsigned int spread)
+{
+    std::size_t width = static_cast<std::size_t>(rect.width);
+    std::size_t height = static_cast<std::size_t>(rect.height);
+    std::vector<float> outer(width * height, 1e20f);
+    std::vector<float> inner(width * height, 0.f);
+
+    for (int y = 0; y < sourceRect.height; ++y)
+    {
+        for (int x = 0; x < sourceRect.width; ++x)
+        {
+            float a = source.getPixel(sourceRect.left + x, sourceRect.top + y).a / 255.f;
+            std::size_t i = (y + spread) * width + (x + spread);
+
+            if (a >= 1.f)
+            {
+                outer[i] = 0.f;
+                inner[i] = 1e20f;
+            }
+            else if (a > 0.f)
+            {
+                float d = 0.5f - a;
+                outer[i] = d > 0.f ? d * d : 0.f;
+                inner[i] = d < 0.f ? d * d : 0.f;
+            }
+        }
+    }
+
+    transformDistances(outer, width, height);
+    transformDistances(inner, width, height);
+
+    for (std::size_t y = 0; y < height; ++y)
+    {
+        for (std::size_t x = 0; x < width; ++x)
+        {
+            std::size_t i = y * width + x;
+            float d = std::sqrt(outer[i]) - std::sqrt(inner[i]);
+            float value = std::min(std::max(0.5f - d / (2.f * spread), 0.f), 1.f);
+
+            std::size_t p = ((rect.top + y) * pixelsWidth + (rect.left + x)) * 4;
+            pixels[p + 3] = static_cast<sf::Uint8>(value * 255.f + 0.5f);
+        }
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Add the glyphs of a run to the vertex array, at the horizontal positions
+// computed by the line layout. Only the outline or the fill layer is added,
+// so that callers can put every outline below every fill.
+////////////////////////////////////////////////////////////////////////////////
+void addRunVertices(std::pmr::vector<sf::Vertex> &vertices, FontMetrics &metrics,
+                    const sfe::RichText::Line::Run &run,
+                    const char32_t *characters, const float *positions,
+                    sf::Vector2f position, bool outline)
+{
+    float outlineThickness = run.stroke.thickness;
+    if (run.length == 0 || (outline && outlineThickness == 0.f))
+        return;
+
+    bool bold = (run.style & sf::Text::Bold) != 0;
+    bool underlined = (run.style & sf::Text::Underlined) != 0;
+    bool strikeThrough = (run.style & sf::Text::StrikeThrough) != 0;
+    float italic = (run.style & sf::Text::Italic) ? 0.208f : 0.f; // 12 degrees
+
+    const sf::Color &color = outline ? run.stroke.outline : run.stroke.fill;
+    float thickness = outline ? outlineThickness : 0.f;
+
+    // The baseline is at characterSize, like in sf::Text
+    unsigned int characterSize = metrics.getCharacterSize();
+    float y = position.y + static_cast<float>(characterSize);
+
+    for (std::size_t i = 0; i < run.length; ++i)
+    {
+        sf::Uint32 curChar = characters[i];
+
+        // Whitespace doesn't need a quad
+        if (curChar == L' ' || curChar == L'\t')
+            continue;
+
+        // The outline uses its own glyph
+        float x = position.x + positions[i];
+        addGlyphQuad(vertices, sf::Vector2f(x, y), color,
+                     metrics.getGlyph(curChar, bold, thickness),
+                     italic, thickness);
+    }
+
+    // The position after the last character is the end of the run
+    float left = position.x + positions[0];
+    float right = position.x + positions[run.length];
+
+    if (underlined)
+    {
+        addLine(vertices, left, right, y, color, metrics.getUnderlinePosition(),
+                metrics.getUnderlineThickness(), thickness);
+    }
+
+    if (strikeThrough)
+    {
+        // Use the center point of the lowercase 'x' glyph as the reference
+        sf::FloatRect xBounds = metrics.getGlyph(L'x', bold).bounds;
+        float strikeThroughOffset = xBounds.top + xBounds.height / 2.f;
+        addLine(vertices, left, right, y, color, strikeThroughOffset,
+                metrics.getUnderlineThickness(), thickness);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Add the glyphs of a run to the vertex array from a distance field atlas.
+// The outline uses the same glyphs as the fill, with a lower edge.
+////////////////////////////////////////////////////////////////////////////////
+void addDistanceFieldRunVertices(std::pmr::vector<sf::Vertex> &vertices, FontMetrics &metrics,
+                                 const sfe::DistanceFieldFont &distanceField,
+                                 const sfe::RichText::Line::Run &run,
+                                 const char32_t *characters, const float *positions,
+                                 sf::Vector2f position, bool outline)
+{
+    float outlineThickness = run.stroke.thickness;
+    if (run.length == 0 || (outline && outlineThickness == 0.f))
+        return;
+
+    bool bold = (run.style & sf::Text::Bold) != 0;
+    bool underlined = (run.style & sf::Text::Underlined) != 0;
+    bool strikeThrough = (run.style & sf::Text::StrikeThrough) != 0;
+    float italic = (run.style & sf::Text::Italic) ? 0.208f : 0.f; // 12 degrees
+
+    const sf::Color &color = outline ? run.stroke.outline : run.stroke.fill;
+    float thickness = outline ? outlineThickness : 0.f;
+
+    // Scale the glyphs of the base size, and their outline thickness
+    unsigned int characterSize = metrics.getCharacterSize();
+    float spread = static_cast<float>(distanceField.getSpread());
+    float scale = static_cast<float>(characterSize) / distanceField.getBaseSize();
+    int level = static_cast<int>(thickness / scale / spread * DistanceFieldMaxLevel + 0.5f);
+    level = std::min(level, DistanceFieldMaxLevel);
+
+    float y = position.y + static_cast<float>(characterSize);
+
+    for (std::size_t i = 0; i < run.length; ++i)
+    {
+        sf::Uint32 curChar = characters[i];
+
+        // Whitespace doesn't need a quad
+        if (curChar == L' ' || curChar == L'\t')
+            continue;
+
+        const sfe::DistanceFieldFont::Glyph &glyph = distanceField.getGlyph(curChar, bold);
+        if (glyph.textureRect.width == 0)
+            continue;
+
+        sf::Glyph quad;
+        quad.bounds = sf::FloatRect((glyph.bounds.left - spread) * scale,
+                                    (glyph.bounds.top - spread) * scale,
+                                    glyph.textureRect.width * scale,
+                                    glyph.textureRect.height * scale);
+        quad.textureRect = glyph.textureRect;
+        quad.textureRect.left += level * DistanceFieldLevelStride;
+
+        float x = position.x + positions[i];
+        addGlyphQuad(vertices, sf::Vector2f(x, y), color, quad, italic);
+    }
+
+    // Lines sample the solid corner of the atlas, at level 0
+    float left = position.x + positions[0];
+    float right = position.x + positions[run.length];
+
+    if (underlined)
+    {
+        addLine(vertices, left, right, y, color, metrics.getUnderlinePosition(),
+                metrics.getUnderlineThickness(), thickness);
+    }
+
+    if (strikeThrough)
+    {
+        sf::FloatRect xBounds = distanceField.getGlyph(L'x', bold).bounds;
+        float strikeThroughOffset = (xBounds.top + xBounds.height / 2.f) * scale;
+        addLine(vertices, left, right, y, color, strikeThroughOffset,
+                metrics.getUnderlineThickness(), thickness);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Binary format of a saved text. Every field is 4 bytes, so the arrays that
+// follow the header can be read in place:
+//
+//     DocumentHeader header;
+//     DocumentLine lines[header.lineCount];
+//     DocumentRun runs[header.runCount];
+//     char32_t characters[header.characterCount];
+//     float positions[header.characterCount + header.lineCount]; // Layout only
+//     std::uint32_t breaks[header.breakCount];                   // Layout only
+//
+// Positions and breaks are the ones of RichText::Line, line after line.
+////////////////////////////////////////////////////////////////////////////////
+constexpr std::uint32_t DocumentMagic = 0x54524653; // "SFRT", read in the byte order of the writer
+constexpr std::uint32_t DocumentVersion = 1;
+constexpr std::uint32_t DocumentHasLayout = 1;
+constexpr std::uint32_t DocumentMaxCharacterSize = 4096; // Larger sizes are taken as corrupted data
+
+struct DocumentHeader
+{
+    std::uint32_t magic;                ///< DocumentMagic
+    std::uint32_t version;              ///< DocumentVersion
+    std::uint32_t flags;                ///< DocumentHasLayout, if positions and breaks follow
+    std::uint32_t characterSize;        ///< Character size
+    float maxWidth;                     ///< Width past which lines wrap, 0 for no wrapping
+    std::uint32_t fontKey;              ///< Hash of the family of the font the layout was computed with
+    std::uint32_t distanceFieldSize;    ///< Base size of the distance field font, 0 for none
+    float rowHeight;                    ///< Line spacing the layout was computed with
+    std::uint32_t lineCount;            ///< Number of lines
+    std::uint32_t runCount;             ///< Number of runs of every line
+    std::uint32_t characterCount;       ///< Number of characters of every line
+    std::uint32_t breakCount;           ///< Number of breaks of every line
+};
+
+struct DocumentLine
+{
+    std::uint32_t length;               ///< Number of characters
+    std::uint32_t runCount;             ///< Number of runs
+    std::uint32_t breakCount;           ///< Number of breaks, 0 without layout
+    float width;                        ///< Width of the widest row, 0 without layout
+};
+
+struct DocumentRun
+{
+    std::uint32_t length;               ///< Number of characters
+    std::uint32_t style;                ///< sf::Text::Style flags
+    std::uint32_t fill;                 ///< Fill color, as 0xRRGGBBAA
+    std::uint32_t outline;              ///< Outline color, as 0xRRGGBBAA
+    float thickness;                    ///< Outline thickness
+};
+
+static_assert(sizeof(DocumentHeader) == 48 && sizeof(DocumentLine) == 16 && sizeof(DocumentRun) == 20,
+              "Saved texts are read in place, their records can't have padding");
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Get the key of the font a saved layout was computed with, as font
+// addresses change from one run to the next: the FNV-1a hash of its family
+// and of a sample of its advances and kernings at the character size. The
+// faces of a family, e.g. Regular and Bold, share the family name but not
+// their advances.
+////////////////////////////////////////////////////////////////////////////////
+std::uint32_t getFontKey(const sf::Font &font, FontMetrics &metrics)
+{
+    std::uint32_t hash = 2166136261u;
+    auto addByte = [&hash](unsigned char byte)
+    {
+        hash ^= byte;
+        hash *= 16777619u;
+    };
+
+    auto addFloat = [&addByte](float value)
+    {
+        unsigned char bytes[sizeof(float)];
+        std::memcpy(bytes, &value, sizeof(float));
+        for (unsigned char byte : bytes)
+            addByte(byte);
+    };
+
+    for (char c : font.getInfo().family)
+        addByte(static_cast<unsigned char>(c));
+
+    for (char32_t character : std::u32string_view(U" 0AWaim."))
+    {
+        addFloat(metrics.getAdvance(character, false));
+        addFloat(metrics.getAdvance(character, true));
+    }
+
+    addFloat(metrics.getKerning(L'A', L'V'));
+    addFloat(metrics.getKerning(L'T', L'o'));
+
+    return hash;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Read-only view of a whole file, mapped in memory where the platform allows
+// it, read into an aligned buffer elsewhere. The view is empty if the file
+// can't be opened.
+////////////////////////////////////////////////////////////////////////////////
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &filename)
+    {
+#if defined(_WIN32)
+        m_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER size;
+        if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+            return;
+
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (m_mapping)
+            m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (m_data)
+            m_size = static_cast<std::size_t>(size.QuadPart);
+#elif defined(__unix__) || defined(__APPLE__)
+        int file = open(filename.c_str(), O_RDONLY);
+        if (file < 0)
+            return;
+
+        // The mapping outlives the descriptor
+        struct stat status;
+        if (fstat(file, &status) == 0 && status.st_size > 0)
+        {
+            std::size_t size = static_cast<std::size_t>(status.st_size);
+            void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+            if (data != MAP_FAILED)
+            {
+                m_data = data;
+                m_size = size;
+            }
+        }
+        close(file);
+#else
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (!file)
+            return;
+
+        std::size_t size = static_cast<std::size_t>(file.tellg());
+        m_buffer.resize((size + 3) / 4);
+        file.seekg(0);
+        if (file.read(reinterpret_cast<char *>(m_buffer.data()), static_cast<std::streamsize>(size)))
+        {
+            m_data = m_buffer.data();
+            m_size = size;
+        }
+#endif
+    }
+
+    ~MappedFile()
+    {
+#if defined(_WIN32)
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+#elif defined(__unix__) || defined(__APPLE__)
+        if (m_data)
+            munmap(const_cast<void *>(m_data), m_size);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator =(const MappedFile &) = delete;
+
+    const void *getData() const { return m_data; }
+    std::size_t getSize() const { return m_size; }
+
+private:
+    const void *m_data = nullptr;                   ///< First byte of the file
+    std::size_t m_size = 0;                         ///< Size of the file
+#if defined(_WIN32)
+    HANDLE m_file = INVALID_HANDLE_VALUE;           ///< File handle
+    HANDLE m_mapping = nullptr;                     ///< File mapping handle
+#elif !defined(__unix__) && !defined(__APPLE__)
+    std::vector<std::uint32_t> m_buffer;            ///< Contents of the file, 4-byte aligned
+#endif
+};
+
+}
 
 namespace sfe
 {
 
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::Line::setCharacterColor(std::size_t pos, sf::Color color)
+Markup::Markup(std::string_view markup)
+{
+    m_text.reserve(markup.size());
+
+    auto addText = [this](std::string_view text, const TextStroke &stroke, sf::Uint32 style)
+    {
+        Segment segment;
+        segment.offset = m_text.size();
+        segment.length = text.size();
+        segment.stroke = stroke;
+        segment.style = style;
+        m_segments.push_back(segment);
+
+        m_text.append(text);
+    };
+
+    auto addArgument = [this](std::size_t index, const TextStroke &stroke, sf::Uint32 style)
+    {
+        Segment segment;
+        segment.argument = index;
+        segment.stroke = stroke;
+        segment.style = style;
+        m_segments.push_back(segment);
+    };
+
+    parseMarkup(markup, true, addText, addArgument);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText::Line::Line()
+    : Line(allocator_type())
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText::Line::Line(const allocator_type &allocator)
+    : m_string(allocator),
+      m_runs(allocator),
+      m_font(nullptr),
+      m_distanceField(nullptr),
+      m_characterSize(30),
+      m_maxWidth(0.f),
+      m_positions(allocator),
+      m_breaks(allocator),
+      m_breaksNeedUpdate(false),
+      m_geometryStart(0),
+      m_vertexOffset(0),
+      m_vertexCount(0),
+      m_vertexTop(0.f),
+      m_verticesNeedUpdate(false)
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText::Line::Line(const Line &other, const allocator_type &allocator)
+    : sf::Transformable(other),
+      sf::Drawable(other),
+      m_string(other.m_string, allocator),
+      m_runs(other.m_runs, allocator),
+      m_font(other.m_font),
+      m_distanceField(other.m_distanceField),
+      m_characterSize(other.m_characterSize),
+      m_maxWidth(other.m_maxWidth),
+      m_positions(other.m_positions, allocator),
+      m_breaks(other.m_breaks, allocator),
+      m_breaksNeedUpdate(other.m_breaksNeedUpdate),
+      m_bounds(other.m_bounds),
+      m_geometryStart(other.m_geometryStart),
+      m_vertexOffset(other.m_vertexOffset),
+      m_vertexCount(other.m_vertexCount),
+      m_vertexTop(other.m_vertexTop),
+      m_verticesNeedUpdate(other.m_verticesNeedUpdate),
+      m_stats(other.m_stats)
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText::Line::Line(Line &&other, const allocator_type &allocator)
+    : sf::Transformable(other),
+      sf::Drawable(other),
+      m_string(std::move(other.m_string), allocator),
+      m_runs(std::move(other.m_runs), allocator),
+      m_font(other.m_font),
+      m_distanceField(other.m_distanceField),
+      m_characterSize(other.m_characterSize),
+      m_maxWidth(other.m_maxWidth),
+      m_positions(std::move(other.m_positions), allocator),
+      m_breaks(std::move(other.m_breaks), allocator),
+      m_breaksNeedUpdate(other.m_breaksNeedUpdate),
+      m_bounds(other.m_bounds),
+      m_geometryStart(other.m_geometryStart),
+      m_vertexOffset(other.m_vertexOffset),
+      m_vertexCount(other.m_vertexCount),
+      m_vertexTop(other.m_vertexTop),
+      m_verticesNeedUpdate(other.m_verticesNeedUpdate),
+      m_stats(other.m_stats)
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::setCharacterColor(std::size_t pos, sf::Color color)
+{
+    assert(pos < getLength());
+    setCharacterColor(pos, pos + 1, color);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::setCharacterColor(std::size_t begin, std::size_t end, sf::Color color)
+{
+    assert(begin <= end && end <= getLength());
+    if (begin == end)
+        return;
+
+    std::size_t first = splitRun(begin);
+    std::size_t last = splitRun(end);
+    for (std::size_t i = first; i < last; ++i)
+        m_runs[i].stroke.fill = color;
+
+    // Colors don't move anything, no need to update geometry
+    mergeRuns(first, last);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::setCharacterStyle(std::size_t pos, sf::Text::Style style)
+{
+    assert(pos < getLength());
+    setCharacterStyle(pos, pos + 1, style);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::setCharacterStyle(std::size_t begin, std::size_t end, sf::Text::Style style)
+{
+    assert(begin <= end && end <= getLength());
+    if (begin == end)
+        return;
+
+    std::size_t first = splitRun(begin);
+    std::size_t last = splitRun(end);
+    for (std::size_t i = first; i < last; ++i)
+        m_runs[i].style = style;
+
+    mergeRuns(first, last);
+    invalidateGeometry(begin);
+}
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::setCharacter(std::size_t pos, sf::Uint32 character)
+{
+    assert(pos < getLength());
+    m_string[pos] = character;
+    invalidateGeometry(pos);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::setCharacterSize(unsigned int size)
+{
+    m_characterSize = size;
+
+    invalidateGeometry(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::setFont(const sf::Font &font)
+{
+    m_font = &font;
+    m_distanceField = nullptr;
+
+    invalidateGeometry(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::setFont(const DistanceFieldFont &font)
+{
+    m_font = &font.getFont();
+    m_distanceField = &font;
+
+    invalidateGeometry(0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::setMaxWidth(float width)
+{
+    // Maybe skip
+    if (m_maxWidth == width)
+        return;
+
+    m_maxWidth = width;
+
+    // A line that didn't wrap and still fits keeps its rows
+    if (m_geometryStart == std::u32string::npos && m_breaks.empty()
+        && (width <= 0.f || m_positions.back() <= width))
+        return;
+
+    m_breaksNeedUpdate = true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+float RichText::Line::getMaxWidth() const
+{
+    return m_maxWidth;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t RichText::Line::getLength() const
+{
+    return m_string.size();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+sf::Color RichText::Line::getCharacterColor(std::size_t pos) const
+{
+    assert(pos < getLength());
+    return m_runs[convertLinePosToLocal(pos)].stroke.fill;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+sf::Uint32 RichText::Line::getCharacterStyle(std::size_t pos) const
+{
+    assert(pos < getLength());
+    return m_runs[convertLinePosToLocal(pos)].style;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+sf::Uint32 RichText::Line::getCharacter(std::size_t pos) const
+{
+    assert(pos < getLength());
+    return m_string[pos];
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::u32string_view RichText::Line::getString() const
+{
+    return m_string;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+const std::pmr::vector<RichText::Line::Run> &RichText::Line::getRuns() const
+{
+    return m_runs;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+const std::pmr::vector<std::size_t> &RichText::Line::getBreaks() const
+{
+    ensureGeometryUpdate();
+
+    return m_breaks;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename Function>
+void RichText::Line::forEachRunRow(Function function) const
+{
+    for (const Run &run : m_runs)
+    {
+        // Wrapped runs are split at the end of each row
+        std::size_t row = std::upper_bound(m_breaks.begin(), m_breaks.end(), run.offset) - m_breaks.begin();
+        Run part = run;
+        while (part.offset < run.offset + run.length)
+        {
+            std::size_t rowStart = row > 0 ? m_breaks[row - 1] : 0;
+            std::size_t rowEnd = row < m_breaks.size() ? m_breaks[row] : m_string.size();
+            part.length = std::min(rowEnd, run.offset + run.length) - part.offset;
+
+            function(part, row, rowStart);
+
+            part.offset += part.length;
+            ++row;
+        }
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<sf::Text> RichText::Line::getTexts() const
+{
+    ensureGeometryUpdate();
+
+    std::vector<sf::Text> texts;
+    texts.reserve(m_runs.size() + m_breaks.size());
+
+    float rowHeight = getRowHeight();
+    forEachRunRow([&](const Run &part, std::size_t row, std::size_t rowStart)
+    {
+        const char32_t *characters = m_string.data() + part.offset;
+
+        sf::Text text;
+        text.setString(sf::String::fromUtf32(characters, characters + part.length));
+        text.setFillColor(part.stroke.fill);
+        text.setOutlineColor(part.stroke.outline);
+        text.setOutlineThickness(part.stroke.thickness);
+        text.setStyle(part.style);
+        text.setCharacterSize(m_characterSize);
+        if (m_font)
+            text.setFont(*m_font);
+        text.setPosition(m_positions[part.offset] - m_positions[rowStart], row * rowHeight);
+
+        texts.push_back(text);
+    });
+
+    return texts;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::appendText(const sf::Text &text)
+{
+    if (text.getCharacterSize() != m_characterSize)
+        setCharacterSize(text.getCharacterSize());
+    if (text.getFont() && text.getFont() != m_font)
+        setFont(*text.getFont());
+
+    TextStroke stroke{ text.getFillColor(), text.getOutlineColor(), text.getOutlineThickness() };
+    appendText(text.getString(), stroke, text.getStyle());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::appendText(const sf::String &string, const TextStroke &stroke,
+                                sf::Uint32 style)
+{
+    appendCharacters(string.begin(), string.end(), stroke, style);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::insert(std::size_t pos, std::u32string_view string,
+                            const TextStroke &stroke, sf::Uint32 style)
+{
+    assert(pos <= getLength());
+
+    // Maybe skip
+    if (string.empty())
+        return;
+
+    // Add a run for the characters where the runs split, and move the
+    // following ones
+    Run run;
+    run.offset = pos;
+    run.length = string.size();
+    run.stroke = stroke;
+    run.style = style;
+
+    std::size_t index = splitRun(pos);
+    m_runs.insert(m_runs.begin() + index, run);
+    for (std::size_t i = index + 1; i < m_runs.size(); ++i)
+        m_runs[i].offset += string.size();
+    SFE_RICHTEXT_COUNT(m_stats.runsCreated, 1);
+
+    m_string.insert(pos, string);
+    mergeRuns(index, index + 1);
+
+    invalidateGeometry(pos);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::erase(std::size_t pos, std::size_t count)
+{
+    assert(pos <= getLength());
+    count = std::min(count, getLength() - pos);
+
+    // Maybe skip
+    if (count == 0)
+        return;
+
+    // Drop the runs of the characters, and move the following ones
+    std::size_t first = splitRun(pos);
+    std::size_t last = splitRun(pos + count);
+    m_runs.erase(m_runs.begin() + first, m_runs.begin() + last);
+    for (std::size_t i = first; i < m_runs.size(); ++i)
+        m_runs[i].offset -= count;
+    SFE_RICHTEXT_COUNT(m_stats.runsDestroyed, last - first);
+
+    m_string.erase(pos, count);
+    mergeRuns(first, first);
+
+    invalidateGeometry(pos);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::appendCharacters(const Line &line, std::size_t pos)
+{
+    for (const Run &run : line.m_runs)
+    {
+        std::size_t begin = std::max(run.offset, pos);
+        std::size_t end = run.offset + run.length;
+        if (begin < end)
+        {
+            appendCharacters(line.m_string.begin() + begin, line.m_string.begin() + end,
+                             run.stroke, run.style);
+        }
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename Iterator>
+void RichText::Line::appendCharacters(Iterator begin, Iterator end,
+                                      const TextStroke &stroke, sf::Uint32 style)
+{
+    // Maybe skip
+    if (begin == end)
+        return;
+
+    Run run;
+    run.offset = m_string.size();
+    run.stroke = stroke;
+    run.style = style;
+
+    // Decode UTF-8, copy anything else
+    if constexpr (sizeof(*begin) == 1)
+    {
+        // There are at most as many characters as bytes
+        std::size_t size = m_string.size() + static_cast<std::size_t>(std::distance(begin, end));
+        if (size > m_string.capacity())
+            m_string.reserve(std::max(size, m_string.capacity() * 2));
+
+        while (begin != end)
+        {
+            sf::Uint32 character;
+            begin = sf::Utf8::decode(begin, end, character);
+            m_string.push_back(static_cast<char32_t>(character));
+        }
+    }
+    else
+    {
+        m_string.append(begin, end);
+    }
+
+    run.length = m_string.size() - run.offset;
+
+    // Extend the last run if it looks the same
+    if (!m_runs.empty() && haveSameAttributes(m_runs.back(), run))
+    {
+        m_runs.back().length += run.length;
+    }
+    else
+    {
+        m_runs.push_back(run);
+        SFE_RICHTEXT_COUNT(m_stats.runsCreated, 1);
+    }
+
+    invalidateGeometry(run.offset);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t RichText::Line::hitTest(sf::Vector2f point) const
+{
+    ensureGeometryUpdate();
+
+    // Find the row, every row is as high as the line spacing
+    float rowHeight = getRowHeight();
+    std::size_t row = 0;
+    if (rowHeight > 0.f && point.y > 0.f)
+        row = std::min(static_cast<std::size_t>(point.y / rowHeight), m_breaks.size());
+
+    std::size_t rowStart = row > 0 ? m_breaks[row - 1] : 0;
+    std::size_t rowEnd = row < m_breaks.size() ? m_breaks[row] : m_string.size();
+
+    // Past the end of the last row is the end of the line
+    float x = m_positions[rowStart] + point.x;
+    if (row == m_breaks.size() && x >= m_positions[rowEnd])
+        return rowEnd;
+
+    // Find the last character starting at or before x
+    auto it = std::upper_bound(m_positions.begin() + rowStart, m_positions.begin() + rowEnd, x);
+    if (it == m_positions.begin() + rowStart)
+        return rowStart;
+
+    return static_cast<std::size_t>(it - m_positions.begin()) - 1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+sf::FloatRect RichText::Line::getCharacterRect(std::size_t pos) const
+{
+    assert(pos <= getLength());
+    ensureGeometryUpdate();
+
+    std::size_t row = std::upper_bound(m_breaks.begin(), m_breaks.end(), pos) - m_breaks.begin();
+    std::size_t rowStart = row > 0 ? m_breaks[row - 1] : 0;
+    float rowHeight = getRowHeight();
+
+    float left = m_positions[pos] - m_positions[rowStart];
+    float width = pos < m_string.size() ? m_positions[pos + 1] - m_positions[pos] : 0.f;
+
+    return sf::FloatRect(left, row * rowHeight, width, rowHeight);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+sf::FloatRect RichText::Line::getLocalBounds() const
+{
+    ensureGeometryUpdate();
+
+    return m_bounds;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+sf::FloatRect RichText::Line::getGlobalBounds() const
+{
+    return getTransform().transformRect(getLocalBounds());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::draw(sf::RenderTarget &target, sf::RenderStates states) const
+{
+    // Nothing to draw without a font
+    if (!m_font)
+        return;
+
+    std::pmr::vector<sf::Vertex> vertices(m_string.get_allocator());
+    appendVertices(vertices, sf::Vector2f());
+    if (vertices.empty())
+        return;
+
+    states.transform *= getTransform();
+    setGlyphStates(states, *m_font, m_characterSize, m_distanceField);
+    target.draw(vertices.data(), vertices.size(), sf::Triangles, states);
+
+    SFE_RICHTEXT_COUNT(m_stats.drawCalls, 1);
+    SFE_RICHTEXT_COUNT(m_stats.verticesDrawn, vertices.size());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t RichText::Line::convertLinePosToLocal(std::size_t& pos) const
+{
+    assert(pos < getLength());
+
+    // Run offsets are sorted, find the last run starting at or before pos
+    auto it = std::upper_bound(m_runs.begin(), m_runs.end(), pos,
+        [](std::size_t value, const Run &run) { return value < run.offset; });
+    std::size_t arrayIndex = static_cast<std::size_t>(it - m_runs.begin()) - 1;
+
+    pos -= m_runs[arrayIndex].offset;
+    return arrayIndex;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t RichText::Line::splitRun(std::size_t pos)
+{
+    assert(pos <= getLength());
+    if (pos == getLength())
+        return m_runs.size();
+
+    std::size_t localPos = pos;
+    std::size_t index = convertLinePosToLocal(localPos);
+    if (localPos == 0)
+        return index;
+
+    Run after = m_runs[index];
+    after.offset += localPos;
+    after.length -= localPos;
+    m_runs[index].length = localPos;
+    m_runs.insert(m_runs.begin() + index + 1, after);
+
+    SFE_RICHTEXT_COUNT(m_stats.runSplits, 1);
+    SFE_RICHTEXT_COUNT(m_stats.runsCreated, 1);
+
+    return index + 1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::mergeRuns(std::size_t first, std::size_t last)
+{
+    // Also look at the runs around the range
+    first = first > 0 ? first - 1 : 0;
+    last = std::min(last + 1, m_runs.size());
+
+    std::size_t merged = first;
+    for (std::size_t i = first + 1; i < last; ++i)
+    {
+        if (haveSameAttributes(m_runs[merged], m_runs[i]))
+            m_runs[merged].length += m_runs[i].length;
+        else
+            m_runs[++merged] = m_runs[i];
+    }
+
+    if (merged + 1 < last)
+    {
+        m_runs.erase(m_runs.begin() + merged + 1, m_runs.begin() + last);
+        SFE_RICHTEXT_COUNT(m_stats.runsDestroyed, last - merged - 1);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::invalidateGeometry(std::size_t pos)
+{
+    m_geometryStart = std::min(m_geometryStart, pos);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::ensureGeometryUpdate() const
+{
+    // Only wrap again, if only the max width changed
+    if (m_geometryStart == std::u32string::npos)
+    {
+        if (m_breaksNeedUpdate)
+            updateBreaks();
+        return;
+    }
+
+    updateGeometry(m_geometryStart);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::updateGeometry(std::size_t pos) const
+{
+    assert(pos <= getLength());
+    m_geometryStart = std::u32string::npos;
+    m_positions.resize(m_string.size() + 1);
+    SFE_RICHTEXT_COUNT(m_stats.lineLayouts, 1);
+
+    if (!m_font)
+    {
+        std::fill(m_positions.begin(), m_positions.end(), 0.f);
+        updateBreaks();
+        return;
+    }
+
+    FontMetrics &metrics = getMetrics(*m_font, m_characterSize, m_distanceField);
+
+    // Characters before pos didn't change, but the kerning between the
+    // previous character and pos may have. Start again from the previous
+    // character, with the pen where it was before its own kerning.
+    float x = 0.f;
+    sf::Uint32 prevChar = 0;
+    if (pos > 0)
+    {
+        --pos;
+        prevChar = pos > 0 ? m_string[pos - 1] : 0;
+        x = m_positions[pos] - metrics.getKerning(prevChar, m_string[pos]);
+    }
+
+    std::size_t localPos = pos;
+    std::size_t index = pos < m_string.size() ? convertLinePosToLocal(localPos) : m_runs.size();
+    for (; index < m_runs.size(); ++index, localPos = 0)
+    {
+        const Run &run = m_runs[index];
+        bool bold = (run.style & sf::Text::Bold) != 0;
+
+        for (std::size_t i = run.offset + localPos; i < run.offset + run.length; ++i)
+        {
+            sf::Uint32 curChar = m_string[i];
+
+            // Apply the kerning offset
+            x += metrics.getKerning(prevChar, curChar);
+            prevChar = curChar;
+
+            m_positions[i] = x;
+            x += metrics.getAdvance(curChar, bold);
+        }
+    }
+
+    m_positions.back() = x;
+
+    updateBreaks();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::updateBreaks() const
+{
+    m_breaksNeedUpdate = false;
+    m_breaks.clear();
+
+    // Every row is as high as the font line spacing, even an empty one
+    m_bounds = sf::FloatRect();
+    m_bounds.height = getRowHeight();
+    m_bounds.width = m_positions.back();
+    if (m_maxWidth <= 0.f || m_bounds.width <= m_maxWidth)
+        return;
+
+    // Break greedily before the first word that doesn't fit in the row, or
+    // before the first character if the word alone doesn't fit. Whitespace
+    // may go past the end of the row, and isn't part of its width.
+    m_bounds.width = 0.f;
+    std::size_t rowStart = 0;
+    std::size_t wordStart = 0;
+    for (std::size_t i = 0; i < m_string.size(); ++i)
+    {
+        sf::Uint32 curChar = m_string[i];
+        if (curChar == L' ' || curChar == L'\t')
+        {
+            wordStart = i + 1;
+            continue;
+        }
+
+        while (i > rowStart && m_positions[i + 1] - m_positions[rowStart] > m_maxWidth)
+        {
+            std::size_t rowEnd = wordStart > rowStart ? wordStart : i;
+            m_breaks.push_back(rowEnd);
+
+            std::size_t last = rowEnd;
+            while (last > rowStart && (m_string[last - 1] == L' ' || m_string[last - 1] == L'\t'))
+                --last;
+            m_bounds.width = std::max(m_bounds.width, m_positions[last] - m_positions[rowStart]);
+
+            rowStart = rowEnd;
+        }
+    }
+
+    m_bounds.width = std::max(m_bounds.width, m_positions.back() - m_positions[rowStart]);
+    m_bounds.height *= static_cast<float>(m_breaks.size() + 1);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+float RichText::Line::getRowHeight() const
+{
+    return m_font ? getMetrics(*m_font, m_characterSize, m_distanceField).getLineSpacing() : 0.f;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::appendVertices(std::pmr::vector<sf::Vertex> &vertices, sf::Vector2f offset) const
+{
+    if (!m_font)
+        return;
+
+    ensureGeometryUpdate();
+
+    FontMetrics &metrics = getMetrics(*m_font, m_characterSize, m_distanceField);
+    float rowHeight = metrics.getLineSpacing();
+
+    for (int outline = 1; outline >= 0; --outline)
+    {
+        forEachRunRow([&](const Run &part, std::size_t row, std::size_t rowStart)
+        {
+            sf::Vector2f rowPosition(offset.x - m_positions[rowStart], offset.y + row * rowHeight);
+            if (m_distanceField)
+            {
+                addDistanceFieldRunVertices(vertices, metrics, *m_distanceField, part,
+                                            m_string.data() + part.offset,
+                                            m_positions.data() + part.offset,
+                                            rowPosition, outline != 0);
+            }
+            else
+            {
+                addRunVertices(vertices, metrics, part,
+                               m_string.data() + part.offset,
+                               m_positions.data() + part.offset,
+                               rowPosition, outline != 0);
+            }
+        });
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::Line::appendLayout(RichTextLayout &layout, std::size_t index, float top) const
+{
+    ensureGeometryUpdate();
+
+    sf::FloatRect bounds = getLocalBounds();
+    bounds.top += top;
+
+    RichTextLayout::Line line;
+    line.firstGlyph = layout.glyphs.size();
+    line.firstRun = layout.runs.size();
+    line.bounds = bounds;
+
+    float rowHeight = getRowHeight();
+    forEachRunRow([&](const Run &part, std::size_t row, std::size_t rowStart)
+    {
+        float left = m_positions[rowStart];
+        float y = bounds.top + row * rowHeight;
+
+        RichTextLayout::Run run;
+        run.line = index;
+        run.offset = part.offset;
+        run.length = part.length;
+        run.bounds = sf::FloatRect(m_positions[part.offset] - left, y,
+                                   m_positions[part.offset + part.length] - m_positions[part.offset],
+                                   rowHeight);
+        run.stroke = part.stroke;
+        run.style = part.style;
+        layout.runs.push_back(run);
+
+        for (std::size_t i = part.offset; i < part.offset + part.length; ++i)
+        {
+            RichTextLayout::Glyph glyph;
+            glyph.character = m_string[i];
+            glyph.position = sf::Vector2f(m_positions[i] - left, y);
+            layout.glyphs.push_back(glyph);
+        }
+    });
+
+    line.glyphCount = layout.glyphs.size() - line.firstGlyph;
+    line.runCount = layout.runs.size() - line.firstRun;
+    layout.lines.push_back(line);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText::Batch::Batch(RichText &text)
+    : m_text(text)
+{
+    m_text.beginEdit();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText::Batch::~Batch()
+{
+    m_text.endEdit();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText::RichText()
+    : RichText(nullptr, std::pmr::get_default_resource())
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText::RichText(const sf::Font& font)
+    : RichText(&font, std::pmr::get_default_resource())
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText::RichText(const sf::Font &font, std::pmr::memory_resource *resource)
+    : RichText(&font, resource)
+{
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+RichText& RichText::operator << (const TextStroke& stroke)
+{
+    m_currentStroke = stroke;
+    return *this;
+}
+
+RichText& RichText::operator << (const Outline& outline)
+{
+    m_currentStroke.outline = outline.outline;
+    m_currentStroke.thickness = outline.thickness;
+    return *this;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+RichText & RichText::operator << (const sf::Color& color)
+{
+    m_currentStroke.fill = color;
+    return *this;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText & RichText::operator << (sf::Text::Style style)
+{
+    m_currentStyle = style;
+    return *this;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText & RichText::operator << (const sf::String& string)
+{
+    appendLines(string.begin(), string.end());
+    return *this;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText & RichText::append(std::u32string_view string)
+{
+    appendLines(string.begin(), string.end());
+    return *this;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText & RichText::append(std::string_view string)
+{
+    appendLines(string.begin(), string.end());
+    return *this;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText & RichText::append(const Markup &markup, std::initializer_list<std::string_view> arguments)
+{
+    TextStroke stroke = m_currentStroke;
+    sf::Text::Style style = m_currentStyle;
+
+    for (const Markup::Segment &segment : markup.m_segments)
+    {
+        std::string_view string;
+        if (segment.argument == std::string::npos)
+            string = std::string_view(markup.m_text).substr(segment.offset, segment.length);
+        else if (segment.argument < arguments.size())
+            string = arguments.begin()[segment.argument];
+
+        m_currentStroke = segment.stroke;
+        m_currentStyle = static_cast<sf::Text::Style>(segment.style);
+        appendLines(string.begin(), string.end());
+    }
+
+    m_currentStroke = stroke;
+    m_currentStyle = style;
+    return *this;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText & RichText::append(const StaticRun *runs, std::size_t count)
+{
+    TextStroke stroke = m_currentStroke;
+    sf::Text::Style style = m_currentStyle;
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const StaticRun &run = runs[i];
+        m_currentStroke = TextStroke{ sf::Color(run.fill), sf::Color(run.outline), run.thickness };
+        m_currentStyle = static_cast<sf::Text::Style>(run.style);
+        appendLines(run.string.begin(), run.string.end());
+    }
+
+    m_currentStroke = stroke;
+    m_currentStyle = style;
+    return *this;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText & RichText::appendMarkup(std::string_view markup)
+{
+    TextStroke stroke = m_currentStroke;
+    sf::Text::Style style = m_currentStyle;
+
+    auto addText = [this](std::string_view text, const TextStroke &textStroke, sf::Uint32 textStyle)
+    {
+        m_currentStroke = textStroke;
+        m_currentStyle = static_cast<sf::Text::Style>(textStyle);
+        appendLines(text.begin(), text.end());
+    };
+
+    parseMarkup(markup, false, addText, [](std::size_t, const TextStroke &, sf::Uint32) {});
+
+    m_currentStroke = stroke;
+    m_currentStyle = style;
+    return *this;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::setCharacterColor(std::size_t line, std::size_t pos, sf::Color color)
+{
+    assert(line < m_lines.size());
+    m_lines[line].setCharacterColor(pos, color);
+    invalidateLineVertices(line);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::setCharacterColor(std::size_t line, std::size_t begin, std::size_t end, sf::Color color)
+{
+    assert(line < m_lines.size());
+    m_lines[line].setCharacterColor(begin, end, color);
+    invalidateLineVertices(line);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::setCharacterStyle(std::size_t line, std::size_t pos, sf::Text::Style style)
+{
+    assert(line < m_lines.size());
+    m_lines[line].setCharacterStyle(pos, style);
+    updateLineGeometry(line);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::setCharacterStyle(std::size_t line, std::size_t begin, std::size_t end, sf::Text::Style style)
+{
+    assert(line < m_lines.size());
+    m_lines[line].setCharacterStyle(begin, end, style);
+    updateLineGeometry(line);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::setCharacter(std::size_t line, std::size_t pos, sf::Uint32 character)
+{
+    assert(line < m_lines.size());
+    m_lines[line].setCharacter(pos, character);
+    updateLineGeometry(line);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::insert(std::size_t line, std::size_t pos, std::u32string_view string)
+{
+    TextStroke stroke = m_currentStroke;
+    sf::Uint32 style = m_currentStyle;
+
+    // Continue the run before pos, or the one after it at the start of a line
+    if (line < m_lines.size() && m_lines[line].getLength() > 0)
+    {
+        const Line &target = m_lines[line];
+        std::size_t localPos = pos > 0 ? pos - 1 : 0;
+        const Line::Run &run = target.m_runs[target.convertLinePosToLocal(localPos)];
+        stroke = run.stroke;
+        style = run.style;
+    }
+
+    insert(line, pos, string, stroke, style);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::insert(std::size_t line, std::size_t pos, std::string_view string)
+{
+    std::u32string decoded;
+    decoded.reserve(string.size());
+    sf::Utf8::toUtf32(string.begin(), string.end(), std::back_inserter(decoded));
+
+    insert(line, pos, std::u32string_view(decoded));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::insert(std::size_t line, std::size_t pos, std::u32string_view string,
+                      const TextStroke &stroke, sf::Uint32 style)
+{
+    // Maybe skip
+    if (string.empty())
+        return;
+
+    // If there isn't any line, just create it
+    if (m_lines.empty())
+    {
+        assert(line == 0);
+        m_lines.push_back(createLine());
+        pushLineHeight(0.f);
+        moveVerticesFrom(0);
+    }
+
+    assert(line < m_lines.size());
+    assert(pos <= m_lines[line].getLength());
+
+    // Insert the first line of text in the line
+    std::size_t lineEnd = string.find(U'\n');
+    if (lineEnd == std::u32string_view::npos)
+    {
+        m_lines[line].insert(pos, string, stroke, style);
+        m_characterCount += string.size();
+        updateLineGeometry(line);
+        evictLines();
+        return;
+    }
+
+    // Move the end of the line after the inserted lines
+    Line &first = m_lines[line];
+    Line tail = createLine();
+    tail.appendCharacters(first, pos);
+    first.erase(pos, first.getLength() - pos);
+    first.insert(pos, string.substr(0, lineEnd), stroke, style);
+
+    std::pmr::vector<Line> added(m_lines.get_allocator());
+    while (lineEnd != std::u32string_view::npos)
+    {
+        std::size_t begin = lineEnd + 1;
+        lineEnd = string.find(U'\n', begin);
+
+        added.push_back(createLine());
+        added.back().insert(0, string.substr(begin, lineEnd - begin), stroke, style);
+    }
+    added.back().appendCharacters(tail, 0);
+
+    // Line ends aren't characters of the lines
+    m_characterCount += string.size() - added.size();
+
+    m_lines.insert(m_lines.begin() + line + 1,
+                   std::make_move_iterator(added.begin()), std::make_move_iterator(added.end()));
+    replaceLines(m_dirtyLines, line + 1, 0, added.size());
+    replaceLines(m_editedLines, line + 1, 0, added.size());
+
+    spliceLines(line, 0, added.size());
+    evictLines();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::erase(std::size_t line, std::size_t pos, std::size_t count)
+{
+    assert(line < m_lines.size());
+    assert(pos <= m_lines[line].getLength());
+
+    // Find the end of the characters, past the end of as many lines as needed
+    std::size_t lastLine = line;
+    std::size_t end = pos;
+    while (count > m_lines[lastLine].getLength() - end && lastLine + 1 < m_lines.size())
+    {
+        count -= m_lines[lastLine].getLength() - end + 1;
+        ++lastLine;
+        end = 0;
+    }
+    end += std::min(count, m_lines[lastLine].getLength() - end);
+
+    // Erase in the line
+    Line &first = m_lines[line];
+    if (lastLine == line)
+    {
+        first.erase(pos, end - pos);
+        m_characterCount -= end - pos;
+        updateLineGeometry(line);
+        return;
+    }
+
+    // Join the start of the first line with the end of the last one, and
+    // drop the lines in between
+    m_characterCount -= first.getLength() - pos;
+    first.erase(pos, first.getLength() - pos);
+    first.appendCharacters(m_lines[lastLine], end);
+    m_characterCount -= end;
+
+    for (std::size_t i = line + 1; i < lastLine; ++i)
+        m_characterCount -= m_lines[i].getLength();
+    for (std::size_t i = line + 1; i <= lastLine; ++i)
+        collectStats(m_lines[i]);
+
+    m_lines.erase(m_lines.begin() + line + 1, m_lines.begin() + lastLine + 1);
+    replaceLines(m_dirtyLines, line + 1, lastLine - line, 0);
+    replaceLines(m_editedLines, line + 1, lastLine - line, 0);
+
+    spliceLines(line, lastLine - line, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::setCharacterSize(unsigned int size)
+{
+    // Maybe skip
+    if (m_characterSize == size)
+        return;
+
+    // Update character size
+    m_characterSize = size;
+
+    // Set texts character size
+    for (Line &line : m_lines)
+        line.setCharacterSize(size);
+
+    updateGeometry();
+    m_geometryNeedUpdate = true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::setFont(const sf::Font& font)
+{
+    // Maybe skip
+    if (m_font == &font && !m_distanceField)
+        return;
+
+    // Update font
+    m_font = &font;
+    m_distanceField = nullptr;
+
+    // Set texts font
+    for (Line &line : m_lines)
+        line.setFont(font);
+
+    updateGeometry();
+    m_geometryNeedUpdate = true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::setFont(const DistanceFieldFont &font)
+{
+    // Maybe skip
+    if (m_distanceField == &font)
+        return;
+
+    // Update font
+    m_font = &font.getFont();
+    m_distanceField = &font;
+
+    // Set texts font
+    for (Line &line : m_lines)
+        line.setFont(font);
+
+    updateGeometry();
+    m_geometryNeedUpdate = true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::clear()
+{
+    for (const Line &line : m_lines)
+        collectStats(line);
+
+    // Clear texts
+    m_lines.clear();
+
+    // Reset bounds
+    m_bounds = sf::FloatRect();
+    m_boundsNeedUpdate = false;
+
+    // Drop the vertices too, the largest storage of the text
+    m_vertices.clear();
+    m_vertices.shrink_to_fit();
+    m_movedVertices.clear();
+    m_movedVertices.shrink_to_fit();
+    m_firstVertex = 0;
+    m_firstMovedLine = std::u32string::npos;
+
+    m_editedLines.clear();
+    m_dirtyLines.clear();
+    m_lineHeights.clear();
+    m_firstLineSlot = 0;
+    m_heightTree.clear();
+    m_heightTreeNeedUpdate = false;
+    m_characterCount = 0;
+    m_geometryNeedUpdate = true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::reserve(std::size_t lines, std::size_t characters)
+{
+    // A quad per character, outlines and underlines may add more
+    m_vertices.reserve(characters * 6);
+    m_movedVertices.reserve(characters * 6);
+
+    // At most one entry per line
+    m_dirtyLines.reserve(lines);
+    m_editedLines.reserve(lines);
+
+    // Heights of the dropped lines are kept until there are more of them
+    // than lines left
+    m_lineHeights.reserve(lines * 2 + 1);
+    m_heightTree.reserve(lines * 2 + 2);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+bool RichText::saveToMemory(std::vector<sf::Uint8> &output, bool withLayout) const
+{
+    // Counts are stored on 32 bits
+    std::size_t runCount = 0;
+    for (const Line &line : m_lines)
+        runCount += line.m_runs.size();
+
+    const std::size_t limit = std::numeric_limits<std::uint32_t>::max();
+    if (m_characterCount + m_lines.size() > limit || runCount > limit)
+        return false;
+
+    // There is no layout without a font
+    withLayout = withLayout && m_font;
+    std::size_t breakCount = 0;
+    if (withLayout)
+    {
+        for (const Line &line : m_lines)
+        {
+            line.ensureGeometryUpdate();
+            breakCount += line.m_breaks.size();
+        }
+    }
+
+    DocumentHeader header = {};
+    header.magic = DocumentMagic;
+    header.version = DocumentVersion;
+    header.characterSize = m_characterSize;
+    header.maxWidth = m_maxWidth;
+    header.lineCount = static_cast<std::uint32_t>(m_lines.size());
+    header.runCount = static_cast<std::uint32_t>(runCount);
+    header.characterCount = static_cast<std::uint32_t>(m_characterCount);
+    header.breakCount = static_cast<std::uint32_t>(breakCount);
+    if (withLayout)
+    {
+        header.flags = DocumentHasLayout;
+        FontMetrics &metrics = getMetrics(*m_font, m_characterSize, m_distanceField);
+        header.fontKey = getFontKey(*m_font, metrics);
+        header.distanceFieldSize = m_distanceField ? m_distanceField->getBaseSize() : 0;
+        header.rowHeight = metrics.getLineSpacing();
+    }
+
+    std::size_t documentSize = sizeof(DocumentHeader) + m_lines.size() * sizeof(DocumentLine)
+                             + runCount * sizeof(DocumentRun) + m_characterCount * sizeof(char32_t);
+    if (withLayout)
+        documentSize += (m_characterCount + m_lines.size()) * sizeof(float) + breakCount * sizeof(std::uint32_t);
+
+    output.resize(documentSize);
+    sf::Uint8 *cursor = output.data();
+    auto write = [&cursor](const void *data, std::size_t bytes)
+    {
+        std::memcpy(cursor, data, bytes);
+        cursor += bytes;
+    };
+
+    write(&header, sizeof(header));
+
+    for (const Line &line : m_lines)
+    {
+        DocumentLine record = {};
+        record.length = static_cast<std::uint32_t>(line.m_string.size());
+        record.runCount = static_cast<std::uint32_t>(line.m_runs.size());
+        if (withLayout)
+        {
+            record.breakCount = static_cast<std::uint32_t>(line.m_breaks.size());
+            record.width = line.m_bounds.width;
+        }
+        write(&record, sizeof(record));
+    }
+
+    for (const Line &line : m_lines)
+    {
+        for (const Line::Run &run : line.m_runs)
+        {
+            DocumentRun record;
+            record.length = static_cast<std::uint32_t>(run.length);
+            record.style = run.style;
+            record.fill = run.stroke.fill.toInteger();
+            record.outline = run.stroke.outline.toInteger();
+            record.thickness = run.stroke.thickness;
+            write(&record, sizeof(record));
+        }
+    }
+
+    for (const Line &line : m_lines)
+        write(line.m_string.data(), line.m_string.size() * sizeof(char32_t));
+
+    if (withLayout)
+    {
+        for (const Line &line : m_lines)
+            write(line.m_positions.data(), line.m_positions.size() * sizeof(float));
+
+        for (const Line &line : m_lines)
+        {
+            for (std::size_t pos : line.m_breaks)
+            {
+                std::uint32_t value = static_cast<std::uint32_t>(pos);
+                write(&value, sizeof(value));
+            }
+        }
+    }
+
+    assert(cursor == output.data() + output.size());
+    return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+bool RichText::saveToFile(const std::string &filename, bool withLayout) const
+{
+    std::vector<sf::Uint8> data;
+    if (!saveToMemory(data, withLayout))
+        return false;
+
+    std::ofstream file(filename, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+    return static_cast<bool>(file);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+bool RichText::loadFromMemory(const void *data, std::size_t size)
+{
+    SFE_RICHTEXT_PROFILE("RichText::loadFromMemory");
+
+    // The records are read in place
+    if (!data || size < sizeof(DocumentHeader)
+        || reinterpret_cast<std::uintptr_t>(data) % alignof(DocumentHeader) != 0)
+        return false;
+
+    const char *bytes = static_cast<const char *>(data);
+    const DocumentHeader &header = *reinterpret_cast<const DocumentHeader *>(bytes);
+    if (header.magic != DocumentMagic || header.version != DocumentVersion)
+        return false;
+
+    // Check that the text can be laid out
+    if (header.characterSize == 0 || header.characterSize > DocumentMaxCharacterSize
+        || !std::isfinite(header.maxWidth) || header.maxWidth < 0.f)
+        return false;
+
+    // Check that the arrays fill the data exactly
+    bool hasLayout = (header.flags & DocumentHasLayout) != 0;
+    std::uint64_t expected = sizeof(DocumentHeader)
+                           + std::uint64_t(header.lineCount) * sizeof(DocumentLine)
+                           + std::uint64_t(header.runCount) * sizeof(DocumentRun)
+                           + std::uint64_t(header.characterCount) * sizeof(char32_t);
+    if (hasLayout)
+    {
+        expected += (std::uint64_t(header.characterCount) + header.lineCount) * sizeof(float)
+                  + std::uint64_t(header.breakCount) * sizeof(std::uint32_t);
+    }
+    if (expected != size || (!hasLayout && header.breakCount != 0))
+        return false;
+
+    const DocumentLine *lines = reinterpret_cast<const DocumentLine *>(bytes + sizeof(DocumentHeader));
+    const DocumentRun *runs = reinterpret_cast<const DocumentRun *>(lines + header.lineCount);
+    const char32_t *characters = reinterpret_cast<const char32_t *>(runs + header.runCount);
+    const float *positions = reinterpret_cast<const float *>(characters + header.characterCount);
+    const std::uint32_t *breaks = reinterpret_cast<const std::uint32_t *>(positions + header.characterCount + header.lineCount);
+
+    // Check that the runs of each line add up to its length, and that its
+    // breaks are sorted inside it
+    std::uint64_t runCount = 0;
+    std::uint64_t characterCount = 0;
+    std::uint64_t breakCount = 0;
+    for (std::uint32_t i = 0; i < header.lineCount; ++i)
+    {
+        const DocumentLine &line = lines[i];
+        if (runCount + line.runCount > header.runCount || breakCount + line.breakCount > header.breakCount)
+            return false;
+
+        std::uint64_t length = 0;
+        for (std::uint32_t j = 0; j < line.runCount; ++j)
+        {
+            if (runs[runCount + j].length == 0)
+                return false;
+            length += runs[runCount + j].length;
+        }
+
+        std::uint32_t previous = 0;
+        for (std::uint32_t j = 0; j < line.breakCount; ++j)
+        {
+            std::uint32_t pos = breaks[breakCount + j];
+            if (pos <= previous || pos >= line.length)
+                return false;
+            previous = pos;
+        }
+
+        if (length != line.length)
+            return false;
+
+        runCount += line.runCount;
+        characterCount += line.length;
+        breakCount += line.breakCount;
+    }
+
+    if (runCount != header.runCount || characterCount != header.characterCount || breakCount != header.breakCount)
+        return false;
+
+    // Line ends aren't characters of the lines
+    if (std::find(characters, characters + header.characterCount, U'\n') != characters + header.characterCount)
+        return false;
+
+    // Replace the text
+    clear();
+    m_characterSize = header.characterSize;
+    m_maxWidth = header.maxWidth;
+
+    // The saved layout holds if it was computed with the same glyphs
+    bool useLayout = hasLayout && m_font
+        && header.distanceFieldSize == (m_distanceField ? m_distanceField->getBaseSize() : 0);
+    if (useLayout)
+    {
+        FontMetrics &metrics = getMetrics(*m_font, m_characterSize, m_distanceField);
+        useLayout = header.fontKey == getFontKey(*m_font, metrics)
+                 && header.rowHeight == metrics.getLineSpacing();
+    }
+
+    for (std::uint32_t i = 0; i < header.lineCount; ++i)
+    {
+        const DocumentLine &record = lines[i];
+
+        m_lines.push_back(createLine());
+        Line &line = m_lines.back();
+        line.m_string.reserve(record.length);
+        line.m_runs.reserve(record.runCount);
+
+        for (const DocumentRun *run = runs; run != runs + record.runCount; ++run)
+        {
+            TextStroke stroke{ sf::Color(run->fill), sf::Color(run->outline), run->thickness };
+            line.appendCharacters(characters, characters + run->length, stroke, run->style);
+            characters += run->length;
+        }
+        runs += record.runCount;
+
+        if (useLayout)
+        {
+            line.m_positions.assign(positions, positions + record.length + 1);
+            line.m_breaks.assign(breaks, breaks + record.breakCount);
+            line.m_bounds = sf::FloatRect(0.f, 0.f, record.width, header.rowHeight * static_cast<float>(record.breakCount + 1));
+            line.m_breaksNeedUpdate = false;
+            line.m_geometryStart = std::u32string::npos;
+        }
+        if (hasLayout)
+        {
+            positions += record.length + 1;
+            breaks += record.breakCount;
+        }
+
+        m_lineHeights.push_back(line.getLocalBounds().height);
+        m_characterCount += record.length;
+    }
+
+    m_heightTreeNeedUpdate = true;
+    m_linePositionsNeedUpdate = true;
+    m_boundsNeedUpdate = true;
+    evictLines();
+    return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+bool RichText::loadFromFile(const std::string &filename)
+{
+    MappedFile file(filename);
+    return loadFromMemory(file.getData(), file.getSize());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::setMaxWidth(float width)
+{
+    // Maybe skip
+    if (m_maxWidth == width)
+        return;
+
+    m_maxWidth = width;
+
+    // Lines whose rows didn't change keep their vertices, unless they moved
+    for (std::size_t i = 0; i < m_lines.size(); ++i)
+    {
+        Line &line = m_lines[i];
+        line.setMaxWidth(width);
+
+        bool rowsChanged = line.m_breaksNeedUpdate || line.m_geometryStart != std::u32string::npos;
+        if (rowsChanged)
+            invalidateLineVertices(i);
+
+        setLineHeight(i, line.getLocalBounds().height);
+    }
+
+    m_boundsNeedUpdate = true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::setMaxLineCount(std::size_t count)
+{
+    m_maxLineCount = count;
+    evictLines();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::setMaxCharacterCount(std::size_t count)
+{
+    m_maxCharacterCount = count;
+    evictLines();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::setClipRect(const sf::FloatRect &rect)
+{
+    m_clipRect = rect;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::beginEdit()
+{
+    ++m_editDepth;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::endEdit()
+{
+    assert(m_editDepth > 0);
+    if (--m_editDepth > 0)
+        return;
+
+    // Lay out every edited line once
+    std::sort(m_editedLines.begin(), m_editedLines.end());
+    m_editedLines.erase(std::unique(m_editedLines.begin(), m_editedLines.end()), m_editedLines.end());
+
+    for (std::size_t index : m_editedLines)
+        updateLineGeometry(index);
+
+    m_editedLines.clear();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::layout()
+{
+    SFE_RICHTEXT_PROFILE("RichText::layout");
+
+    // Also compute the lazy transforms, which sf::Transformable caches too
+    placeLines();
+    for (const Line &line : m_lines)
+    {
+        line.ensureGeometryUpdate();
+        line.getTransform();
+    }
+
+    ensureBoundsUpdate();
+    ensureGeometryUpdate();
+    getTransform();
+    getInverseTransform();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::layoutAll(const std::vector<RichText *> &texts, unsigned int threadCount)
+{
+    SFE_RICHTEXT_PROFILE("RichText::layoutAll");
+
+    if (threadCount == 0)
+        threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    threadCount = static_cast<unsigned int>(std::min<std::size_t>(threadCount, texts.size()));
+
+    // Rasterising glyphs updates the font textures, which needs the OpenGL
+    // context of this thread. Load them all first, so that the other threads
+    // only read the glyph caches.
+    for (const RichText *text : texts)
+        text->prewarmGlyphs();
+
+    // Each thread takes the next text until there's none left
+    std::atomic<std::size_t> next(0);
+    auto work = [&texts, &next]()
+    {
+        for (std::size_t i = next++; i < texts.size(); i = next++)
+            texts[i]->layout();
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; i < threadCount; ++i)
+        threads.emplace_back(work);
+
+    work();
+
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+sf::Color RichText::getCharacterColor(std::size_t line, std::size_t pos) const
+{
+    assert(line < m_lines.size());
+    return m_lines[line].getCharacterColor(pos);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+sf::Uint32 RichText::getCharacterStyle(std::size_t line, std::size_t pos) const
+{
+    assert(line < m_lines.size());
+    return m_lines[line].getCharacterStyle(pos);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+sf::Uint32 RichText::getCharacter(std::size_t line, std::size_t pos) const
+{
+    assert(line < m_lines.size());
+    return m_lines[line].getCharacter(pos);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t RichText::getLineCount() const
+{
+    return m_lines.size();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+const RichText::Line &RichText::getLine(std::size_t index) const
+{
+    assert(index < m_lines.size());
+
+    placeLine(index);
+    return m_lines[index];
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+const std::pmr::deque<RichText::Line> &RichText::getLines() const
+{
+    placeLines();
+    return m_lines;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::clearFontCache()
+{
+    FontMetrics::clear();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::setProfileCallback(ProfileCallback callback)
+{
+    profileCallback.store(callback, std::memory_order_relaxed);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::prewarm(const sf::Font &font, std::u32string_view characters,
+                       const std::vector<GlyphSet> &glyphSets)
+{
+    for (const GlyphSet &glyphSet : glyphSets)
+    {
+        FontMetrics &metrics = FontMetrics::get(font, glyphSet.characterSize);
+
+        for (char32_t character : characters)
+        {
+            // Tabs are laid out with the space glyph, and line feeds aren't drawn
+            if (character == U'\n')
+                continue;
+            if (character == U'\t')
+                character = U' ';
+
+            metrics.getGlyph(character, glyphSet.bold, glyphSet.outlineThickness);
+        }
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::prewarm(const sf::Font &font, std::string_view characters,
+                       const std::vector<GlyphSet> &glyphSets)
+{
+    std::u32string decoded;
+    decoded.reserve(characters.size());
+    sf::Utf8::toUtf32(characters.begin(), characters.end(), std::back_inserter(decoded));
+
+    prewarm(font, std::u32string_view(decoded), glyphSets);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::prewarmGlyphs() const
+{
+    // Maybe skip
+    if (!m_font || m_lines.empty())
+        return;
+
+    std::u32string characters = getCharacterSet();
+    std::vector<GlyphSet> glyphSets = getGlyphSets();
+    prewarm(*m_font, characters, glyphSets);
+
+    // Distance field glyphs are rendered into their own atlas too
+    if (m_distanceField)
+    {
+        for (const GlyphSet &glyphSet : glyphSets)
+        {
+            for (char32_t character : characters)
+            {
+                if (character != U'\n')
+                    m_distanceField->getGlyph(character, glyphSet.bold);
+            }
+        }
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<GlyphSet> RichText::getGlyphSets() const
 {
-    assert(pos < getLength());
-    isolateCharacter(pos);
-    std::size_t stringToFormat = convertLinePosToLocal(pos);
-    m_texts[stringToFormat].setFillColor(color);
-    updateGeometry();
+    std::vector<GlyphSet> glyphSets;
+
+    for (const Line &line : m_lines)
+    {
+        for (const Line::Run &run : line.m_runs)
+        {
+            if (run.length == 0)
+                continue;
+
+            GlyphSet glyphSet;
+            glyphSet.characterSize = line.m_characterSize;
+            glyphSet.bold = (run.style & sf::Text::Bold) != 0;
+
+            // Distance field glyphs are rasterised once, at the base size
+            if (line.m_distanceField)
+            {
+                glyphSet.characterSize = line.m_distanceField->getBaseSize();
+                glyphSets.push_back(glyphSet);
+                continue;
+            }
+
+            glyphSets.push_back(glyphSet);
+
+            if (run.stroke.thickness != 0.f)
+            {
+                glyphSet.outlineThickness = run.stroke.thickness;
+                glyphSets.push_back(glyphSet);
+            }
+        }
+    }
+
+    std::sort(glyphSets.begin(), glyphSets.end());
+    glyphSets.erase(std::unique(glyphSets.begin(), glyphSets.end()), glyphSets.end());
+
+    return glyphSets;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::u32string RichText::getCharacterSet() const
+{
+    std::u32string characters;
+
+    for (const Line &line : m_lines)
+    {
+        for (char32_t character : line.m_string)
+            characters += (character == U'\t') ? U' ' : character;
+
+        // Strike through lines are placed with the lowercase 'x' glyph
+        for (const Line::Run &run : line.m_runs)
+        {
+            if (run.length != 0 && (run.style & sf::Text::StrikeThrough))
+                characters += U'x';
+        }
+    }
+
+    std::sort(characters.begin(), characters.end());
+    characters.erase(std::unique(characters.begin(), characters.end()), characters.end());
+
+    return characters;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+float RichText::getMaxWidth() const
+{
+    return m_maxWidth;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichTextLayout RichText::getLayout() const
+{
+    RichTextLayout layout;
+    layout.characterSize = m_characterSize;
+    layout.bounds = getLocalBounds();
+    layout.lines.reserve(m_lines.size());
+    layout.glyphs.reserve(m_characterCount);
+
+    float top = 0.f;
+    for (std::size_t i = 0; i < m_lines.size(); ++i)
+    {
+        m_lines[i].appendLayout(layout, i, top);
+        top += m_lines[i].getLocalBounds().height;
+    }
+
+    return layout;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename Iterator>
+RichTextLayout RichText::measureLines(const sf::Font &font, Iterator begin, Iterator end,
+                                      unsigned int characterSize, float maxWidth)
+{
+    RichTextLayout layout;
+    layout.characterSize = characterSize;
+
+    // Maybe skip, an empty text has no line
+    if (begin == end)
+        return layout;
+
+    Line line;
+    line.setFont(font);
+    line.setCharacterSize(characterSize);
+    line.setMaxWidth(maxWidth);
+
+    for (std::size_t index = 0; ; ++index)
+    {
+        Iterator lineEnd = std::find(begin, end, '\n');
+
+        // Reuse the storage of the previous line
+        line.m_string.clear();
+        line.m_runs.clear();
+        line.invalidateGeometry(0);
+        line.appendCharacters(begin, lineEnd, TextStroke(), sf::Text::Regular);
+        line.appendLayout(layout, index, layout.bounds.height);
+
+        sf::FloatRect bounds = line.getLocalBounds();
+        layout.bounds.width = std::max(layout.bounds.width, bounds.width);
+        layout.bounds.height += bounds.height;
+
+        if (lineEnd == end)
+            break;
+        begin = lineEnd + 1;
+    }
+
+    return layout;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t RichText::getMaxLineCount() const
+{
+    return m_maxLineCount;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t RichText::getMaxCharacterCount() const
+{
+    return m_maxCharacterCount;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::size_t RichText::getCharacterCount() const
+{
+    return m_characterCount;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichTextPosition RichText::hitTest(sf::Vector2f point) const
+{
+    RichTextPosition position;
+    if (m_lines.empty())
+        return position;
+
+    // Lines keep their position when older ones are dropped
+    point = getInverseTransform().transformPoint(point);
+    point.y += getTop();
+
+    position.line = std::min(findLine(point.y), m_lines.size() - 1);
+    const Line &line = m_lines[position.line];
+    position.pos = line.hitTest(point - sf::Vector2f(0.f, getLineTop(position.line)));
+
+    return position;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+sf::FloatRect RichText::getCharacterRect(std::size_t line, std::size_t pos) const
+{
+    assert(line < m_lines.size());
+
+    sf::FloatRect rect = m_lines[line].getCharacterRect(pos);
+    rect.top += getLineTop(line) - getTop();
+
+    return getTransform().transformRect(rect);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::shared_ptr<const RichTextDocument> RichText::share() const
+{
+    std::shared_ptr<RichTextDocument> document(new RichTextDocument());
+    document->m_bounds = getLocalBounds();
+    document->m_font = m_font;
+    document->m_distanceField = m_distanceField;
+    document->m_characterSize = m_characterSize;
+
+    ensureGeometryUpdate();
+    if (m_lines.empty())
+        return document;
+
+    std::size_t begin = m_lines.front().m_vertexOffset;
+    std::size_t end = m_lines.back().m_vertexOffset + m_lines.back().m_vertexCount;
+    document->m_vertices.assign(m_vertices.begin() + begin, m_vertices.begin() + end);
+
+    // Lines keep their position when older ones are dropped, move them up
+    float top = getTop();
+    if (top != 0.f)
+    {
+        for (sf::Vertex &vertex : document->m_vertices)
+            vertex.position.y -= top;
+    }
+
+    return document;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichTextStats RichText::getStats() const
+{
+    RichTextStats stats = m_stats;
+    stats.bytesHeld = (m_vertices.capacity() + m_movedVertices.capacity()) * sizeof(sf::Vertex)
+                    + m_dirtyLines.capacity() * sizeof(std::size_t)
+                    + m_editedLines.capacity() * sizeof(std::size_t)
+                    + m_lineHeights.capacity() * sizeof(float)
+                    + m_heightTree.capacity() * sizeof(double);
+
+    for (const Line &line : m_lines)
+    {
+        addStats(stats, line.m_stats);
+        stats.bytesHeld += sizeof(Line)
+                         + line.m_string.capacity() * sizeof(char32_t)
+                         + line.m_runs.capacity() * sizeof(Line::Run)
+                         + line.m_positions.capacity() * sizeof(float)
+                         + line.m_breaks.capacity() * sizeof(std::size_t);
+    }
+
+    return stats;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::resetStats()
+{
+    m_stats = RichTextStats();
+    for (const Line &line : m_lines)
+        line.m_stats = RichTextStats();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+const sf::FloatRect &RichText::getClipRect() const
+{
+    return m_clipRect;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+std::pmr::memory_resource *RichText::getMemoryResource() const
+{
+    return m_lines.get_allocator().resource();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+unsigned int RichText::getCharacterSize() const
+{
+    return m_characterSize;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+const sf::Font *RichText::getFont() const
+{
+    return m_font;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+const DistanceFieldFont *RichText::getDistanceFieldFont() const
+{
+    return m_distanceField;
+}
+
+
+////////////////////////////////////////////////////////////
+sf::FloatRect RichText::getLocalBounds() const
+{
+    ensureBoundsUpdate();
+
+    return m_bounds;
+}
+
+
+////////////////////////////////////////////////////////////
+sf::FloatRect RichText::getGlobalBounds() const
+{
+    return getTransform().transformRect(getLocalBounds());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::draw(sf::RenderTarget& target, sf::RenderStates states) const
+{
+    // Nothing to draw without a font
+    if (!m_font)
+        return;
+
+    SFE_RICHTEXT_PROFILE("RichText::draw");
+
+    ensureGeometryUpdate();
+    if (m_lines.empty())
+        return;
+
+    // Lines keep their position when older ones are dropped, move them up
+    states.transform *= getTransform();
+    states.transform.translate(0.f, -getTop());
+    setGlyphStates(states, *m_font, m_characterSize, m_distanceField);
+
+    // Find the visible area, in line coordinates
+    const sf::View &view = target.getView();
+    sf::FloatRect visible = view.getInverseTransform().transformRect(sf::FloatRect(-1.f, -1.f, 2.f, 2.f));
+    visible = states.transform.getInverse().transformRect(visible);
+    if (m_clipRect.width > 0.f && m_clipRect.height > 0.f)
+    {
+        sf::FloatRect clip = m_clipRect;
+        clip.top += getTop();
+        if (!clip.intersects(visible, visible))
+            return;
+    }
+
+    // Only draw the lines in that area. Their vertices are contiguous, so a
+    // single call is still enough.
+    float bottom = visible.top + visible.height;
+    std::size_t first = findLine(visible.top);
+    std::size_t last = findLine(bottom);
+    if (last < m_lines.size() && getLineTop(last) < bottom)
+        ++last;
+    if (first >= last)
+        return;
+
+    std::size_t begin = m_lines[first].m_vertexOffset;
+    std::size_t end = m_lines[last - 1].m_vertexOffset + m_lines[last - 1].m_vertexCount;
+    if (begin == end)
+        return;
+
+    target.draw(&m_vertices[begin], end - begin, sf::Triangles, states);
+
+    SFE_RICHTEXT_COUNT(m_stats.drawCalls, 1);
+    SFE_RICHTEXT_COUNT(m_stats.verticesDrawn, end - begin);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText::RichText(const sf::Font* font, std::pmr::memory_resource *resource)
+    : m_lines(resource),
+      m_font(font),
+      m_distanceField(nullptr),
+      m_characterSize(30),
+      m_maxWidth(0.f),
+      m_currentStroke{ sf::Color::White, sf::Color::Transparent },
+      m_currentStyle(sf::Text::Regular),
+      m_vertices(resource),
+      m_movedVertices(resource),
+      m_geometryNeedUpdate(false),
+      m_dirtyLines(resource),
+      m_firstMovedLine(std::u32string::npos),
+      m_firstVertex(0),
+      m_boundsNeedUpdate(false),
+      m_lineHeights(resource),
+      m_firstLineSlot(0),
+      m_heightTree(resource),
+      m_heightTreeNeedUpdate(false),
+      m_linePositionsNeedUpdate(false),
+      m_editDepth(0),
+      m_editedLines(resource),
+      m_maxLineCount(0),
+      m_maxCharacterCount(0),
+      m_characterCount(0)
+{
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+RichText::Line RichText::createLine() const
+{
+    Line line(m_lines.get_allocator());
+    line.m_verticesNeedUpdate = true;
+    line.setCharacterSize(m_characterSize);
+    line.setMaxWidth(m_maxWidth);
+    if (m_distanceField)
+        line.setFont(*m_distanceField);
+    else if (m_font)
+        line.setFont(*m_font);
+
+    return line;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename Iterator>
+void RichText::appendLines(Iterator begin, Iterator end)
+{
+    // Maybe skip
+    if (begin == end)
+        return;
+
+    // If there isn't any line, just create it
+    if (m_lines.empty())
+    {
+        m_lines.push_back(createLine());
+        pushLineHeight(0.f);
+    }
+
+    // The last line and the new ones are added to the end of the vertices
+    invalidateLineVertices(m_lines.size() - 1);
+    moveVerticesFrom(m_lines.size() - 1);
+
+    // Append the first line of text to the last line
+    Iterator lineEnd = std::find(begin, end, '\n');
+    Line &last = m_lines.back();
+    std::size_t length = last.getLength();
+    float width = m_boundsNeedUpdate ? 0.f : last.getLocalBounds().width;
+    last.appendCharacters(begin, lineEnd, m_currentStroke, m_currentStyle);
+    m_characterCount += last.getLength() - length;
+    setLineHeight(m_lines.size() - 1, last.getLocalBounds().height);
+    updateBounds(last, width);
+
+    // Append the rest as new lines, below the last one
+    while (lineEnd != end) {
+        begin = lineEnd + 1;
+        lineEnd = std::find(begin, end, '\n');
+
+        m_lines.push_back(createLine());
+        Line &line = m_lines.back();
+        line.appendCharacters(begin, lineEnd, m_currentStroke, m_currentStyle);
+        m_characterCount += line.getLength();
+        pushLineHeight(line.getLocalBounds().height);
+        m_linePositionsNeedUpdate = true;
+
+        // Update bounds
+        updateBounds(line);
+    }
+
+    evictLines();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::updateGeometry()
+{
+    m_bounds = sf::FloatRect();
+    m_boundsNeedUpdate = false;
+
+    // Lines start at zero again, the vertices are rebuilt anyway
+    m_lineHeights.clear();
+    m_firstLineSlot = 0;
+    m_heightTreeNeedUpdate = true;
+    m_linePositionsNeedUpdate = true;
+
+    for (const Line &line : m_lines) {
+        sf::FloatRect bounds = line.getLocalBounds();
+        m_lineHeights.push_back(bounds.height);
+
+        m_bounds.height += bounds.height;
+        m_bounds.width = std::max(m_bounds.width, bounds.width);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::updateBounds(const Line &line, float previousWidth)
+{
+    // Outdated bounds are recomputed from scratch anyway
+    if (m_boundsNeedUpdate)
+        return;
+
+    sf::FloatRect bounds = line.getLocalBounds();
+    if (bounds.width < previousWidth)
+    {
+        m_boundsNeedUpdate = true;
+        return;
+    }
+
+    m_bounds.height = getLineTop(m_lines.size()) - getTop();
+    m_bounds.width = std::max(m_bounds.width, bounds.width);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void RichText::updateLineGeometry(std::size_t index)
+{
+    // Wait for the end of the batch
+    if (m_editDepth > 0)
+    {
+        if (m_editedLines.empty() || m_editedLines.back() != index)
+            m_editedLines.push_back(index);
+        return;
+    }
+
+    // Move the following lines if the height of the line changed
+    setLineHeight(index, m_lines[index].getLocalBounds().height);
+
+    // The line may have been the widest one
+    m_boundsNeedUpdate = true;
+
+    invalidateLineVertices(index);
 }
 
+
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::Line::setCharacterStyle(std::size_t pos, sf::Text::Style style)
+void RichText::invalidateLineVertices(std::size_t index)
 {
-    assert(pos < getLength());
-    isolateCharacter(pos);
-    std::size_t stringToFormat = convertLinePosToLocal(pos);
-    m_texts[stringToFormat].setStyle(style);
-    updateGeometry();
+    // Everything is rebuilt anyway
+    if (m_geometryNeedUpdate)
+        return;
+
+    // Lines from the first moved one are checked when they are moved, the
+    // previous ones are rebuilt in place
+    const Line &line = m_lines[index];
+    if (!line.m_verticesNeedUpdate)
+    {
+        line.m_verticesNeedUpdate = true;
+        if (index < m_firstMovedLine)
+            m_dirtyLines.push_back(index);
+    }
 }
+
+
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::Line::setCharacter(std::size_t pos, sf::Uint32 character)
+void RichText::moveVerticesFrom(std::size_t index)
 {
-    assert(pos < getLength());
-    sf::Text& text = m_texts[convertLinePosToLocal(pos)];
-    sf::String string = text.getString();
-    string[pos] = character;
-    text.setString(string);
-    updateGeometry();
+    m_firstMovedLine = std::min(m_firstMovedLine, index);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::Line::setCharacterSize(unsigned int size)
+void RichText::evictLines()
 {
-    for (sf::Text &text : m_texts)
-        text.setCharacterSize(size);
+    std::size_t count = 0;
+    while (m_lines.size() > 1
+        && ((m_maxLineCount > 0 && m_lines.size() > m_maxLineCount)
+         || (m_maxCharacterCount > 0 && m_characterCount > m_maxCharacterCount)))
+    {
+        m_characterCount -= m_lines.front().getLength();
+        collectStats(m_lines.front());
+        m_lines.pop_front();
+        ++m_firstLineSlot;
+        ++count;
+    }
 
-    updateGeometry();
+    // Maybe skip
+    if (count == 0)
+        return;
+
+    // Line indices of pending edits move up too
+    replaceLines(m_dirtyLines, 0, count, 0);
+    replaceLines(m_editedLines, 0, count, 0);
+    if (m_firstMovedLine != std::u32string::npos)
+        m_firstMovedLine = m_firstMovedLine > count ? m_firstMovedLine - count : 0;
+
+    // Skip the vertices of the dropped lines, if the first line has some.
+    // The vertices of the following lines are after them.
+    if (!m_geometryNeedUpdate && !m_lines.front().m_verticesNeedUpdate)
+        m_firstVertex = m_lines.front().m_vertexOffset;
+
+    // The dropped lines may have been the widest ones
+    m_boundsNeedUpdate = true;
+
+    // Once more lines were dropped than there are left, move everything
+    // back to zero. The remaining lines don't move until then.
+    if (m_firstLineSlot > m_lines.size())
+        rebaseLines();
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::Line::setFont(const sf::Font &font)
+void RichText::spliceLines(std::size_t index, std::size_t removed, std::size_t added)
 {
-    for (sf::Text &text : m_texts)
-        text.setFont(font);
+    // The following lines keep their height, and only move
+    auto slot = m_lineHeights.begin() + m_firstLineSlot + index + 1;
+    slot = m_lineHeights.erase(slot, slot + removed);
+    m_lineHeights.insert(slot, added, 0.f);
 
-    updateGeometry();
+    for (std::size_t i = index; i <= index + added; ++i)
+        m_lineHeights[m_firstLineSlot + i] = m_lines[i].getLocalBounds().height;
+
+    m_heightTreeNeedUpdate = true;
+    m_linePositionsNeedUpdate = true;
+
+    // The lines may have been the widest ones
+    m_boundsNeedUpdate = true;
+
+    invalidateLineVertices(index);
+    moveVerticesFrom(index + 1);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-std::size_t RichText::Line::getLength() const
+void RichText::setLineHeight(std::size_t index, float height)
 {
-    std::size_t count = 0;
-    for (sf::Text &text : m_texts)
+    std::size_t slot = m_firstLineSlot + index;
+
+    // Maybe skip
+    if (m_lineHeights[slot] == height)
+        return;
+
+    // The sums are rebuilt anyway if outdated
+    if (!m_heightTreeNeedUpdate)
+        addHeight(m_heightTree, slot, static_cast<double>(height) - m_lineHeights[slot]);
+    m_lineHeights[slot] = height;
+
+    if (index + 1 < m_lines.size())
     {
-        count += text.getString().getSize();
+        m_linePositionsNeedUpdate = true;
+        moveVerticesFrom(index + 1);
     }
-    return count;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-sf::Color RichText::Line::getCharacterColor(std::size_t pos) const
+void RichText::pushLineHeight(float height)
 {
-    assert(pos < getLength());
-    return m_texts[convertLinePosToLocal(pos)].getFillColor();
+    m_lineHeights.push_back(height);
+
+    // The sums are rebuilt anyway if outdated
+    if (!m_heightTreeNeedUpdate)
+        pushHeight(m_heightTree, height);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-sf::Uint32 RichText::Line::getCharacterStyle(std::size_t pos) const
+void RichText::collectStats(const Line &line)
 {
-    assert(pos < getLength());
-    return m_texts[convertLinePosToLocal(pos)].getStyle();
+    addStats(m_stats, line.m_stats);
+    SFE_RICHTEXT_COUNT(m_stats.runsDestroyed, line.m_runs.size());
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-sf::Uint32 RichText::Line::getCharacter(std::size_t pos) const
+void RichText::rebaseLines()
 {
-    assert(pos < getLength());
-    sf::Text& text = m_texts[convertLinePosToLocal(pos)];
-    return text.getString()[pos];
+    float top = getTop();
+
+    m_lineHeights.erase(m_lineHeights.begin(), m_lineHeights.begin() + m_firstLineSlot);
+    m_firstLineSlot = 0;
+    m_heightTreeNeedUpdate = true;
+    m_linePositionsNeedUpdate = true;
+
+    // Everything is rebuilt anyway
+    if (m_geometryNeedUpdate)
+        return;
+
+    // Move the vertices up too, and drop the ones of the dropped lines
+    for (std::size_t i = m_firstVertex; i < m_vertices.size(); ++i)
+    {
+        sf::Vertex vertex = m_vertices[i];
+        vertex.position.y -= top;
+        m_vertices[i - m_firstVertex] = vertex;
+    }
+    m_vertices.resize(m_vertices.size() - m_firstVertex);
+
+    // Lines rebuilt on next draw don't have vertices yet
+    for (std::size_t i = 0; i < m_lines.size(); ++i)
+    {
+        const Line &line = m_lines[i];
+        if (i >= m_firstMovedLine && line.m_verticesNeedUpdate)
+            continue;
+
+        line.m_vertexOffset -= m_firstVertex;
+        line.m_vertexTop -= top;
+    }
+
+    m_firstVertex = 0;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-const std::vector<sf::Text> &RichText::Line::getTexts() const
+std::size_t RichText::findLine(float y) const
 {
-    return m_texts;
+    // Lines are sorted by position, and don't overlap. The dropped lines
+    // are above the first one.
+    ensureHeightTreeUpdate();
+    std::size_t slot = findHeight(m_heightTree, y);
+
+    return slot > m_firstLineSlot ? slot - m_firstLineSlot : 0;
 }
 
+
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::Line::appendText(sf::Text text)
+float RichText::getTop() const
 {
-    updateTextAndGeometry(text);
-    m_texts.push_back(std::move(text));
+    return getLineTop(0);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-sf::FloatRect RichText::Line::getLocalBounds() const
+float RichText::getLineTop(std::size_t index) const
 {
-    return m_bounds;
+    ensureHeightTreeUpdate();
+
+    return static_cast<float>(sumHeights(m_heightTree, m_firstLineSlot + index));
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-sf::FloatRect RichText::Line::getGlobalBounds() const
+void RichText::placeLine(std::size_t index) const
 {
-    return getTransform().transformRect(getLocalBounds());
+    // Maybe skip
+    if (!m_linePositionsNeedUpdate)
+        return;
+
+    // Only write moved lines, so that threads can read the same text
+    Line &line = m_lines[index];
+    float top = getLineTop(index);
+    if (line.getPosition().y != top)
+        line.setPosition(0.f, top);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::Line::draw(sf::RenderTarget &target, sf::RenderStates states) const
+void RichText::placeLines() const
 {
-    states.transform *= getTransform();
+    // Maybe skip
+    if (!m_linePositionsNeedUpdate)
+        return;
 
-    for (const sf::Text &text : m_texts)
-        target.draw(text, states);
+    for (std::size_t i = 0; i < m_lines.size(); ++i)
+        placeLine(i);
+
+    m_linePositionsNeedUpdate = false;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-std::size_t RichText::Line::convertLinePosToLocal(std::size_t& pos) const
+void RichText::ensureHeightTreeUpdate() const
 {
-    assert(pos < getLength());
-    std::size_t arrayIndex = 0;
-    for (; pos >= m_texts[arrayIndex].getString().getSize(); ++arrayIndex)
-    {
-        pos -= m_texts[arrayIndex].getString().getSize();
-    }
-    return arrayIndex;
+    // Maybe skip
+    if (!m_heightTreeNeedUpdate)
+        return;
+
+    m_heightTreeNeedUpdate = false;
+    buildHeightTree(m_heightTree, m_lineHeights);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::Line::isolateCharacter(std::size_t pos)
+void RichText::ensureGeometryUpdate() const
 {
-    std::size_t localPos = pos;
-    std::size_t index = convertLinePosToLocal(localPos);
-    sf::Text temp = m_texts[index];
-
-    sf::String string = temp.getString();
-    if (string.getSize() == 1)
+    // Do nothing, if the vertices are up to date. Nothing is written then,
+    // so that threads can draw or read the same text at the same time.
+    if (!m_geometryNeedUpdate && m_dirtyLines.empty()
+        && m_firstMovedLine == std::u32string::npos)
         return;
 
-    m_texts.erase(m_texts.begin() + index);
-    if (localPos != string.getSize() - 1)
+    SFE_RICHTEXT_PROFILE("RichText::ensureGeometryUpdate");
+    SFE_RICHTEXT_COUNT(m_stats.textLayouts, 1);
+
+    // Rebuild every line, if the font or the size changed
+    bool rebuild = m_geometryNeedUpdate;
+    if (rebuild)
+    {
+        m_geometryNeedUpdate = false;
+        m_firstMovedLine = 0;
+    }
+
+    // Rebuild the vertices of the edited lines in place, as long as their
+    // vertex count didn't change. Otherwise, the following lines move.
+    for (std::size_t index : m_dirtyLines)
     {
-        temp.setString(string.substring(localPos+1));
-        m_texts.insert(m_texts.begin() + index, temp);
+        const Line &line = m_lines[index];
+        if (index >= m_firstMovedLine)
+            continue;
+
+        // The line didn't move
+        m_movedVertices.clear();
+        line.appendVertices(m_movedVertices, sf::Vector2f(0.f, line.m_vertexTop));
+        if (m_movedVertices.size() != line.m_vertexCount)
+        {
+            m_firstMovedLine = index;
+            continue;
+        }
+
+        std::copy(m_movedVertices.begin(), m_movedVertices.end(), m_vertices.begin() + line.m_vertexOffset);
+        line.m_verticesNeedUpdate = false;
     }
+    m_dirtyLines.clear();
+
+    // Do nothing, if no line moved
+    if (m_firstMovedLine == std::u32string::npos)
+        return;
+
+    // Put the vertices of the moved lines aside. Those of the removed
+    // lines after the last one are dropped, and those of the evicted lines
+    // are dropped when moving from the first line.
+    std::size_t first = std::min(m_firstMovedLine, m_lines.size());
+    std::size_t start = m_firstVertex;
+    if (first > 0)
+        start = m_lines[first - 1].m_vertexOffset + m_lines[first - 1].m_vertexCount;
+
+    m_movedVertices.clear();
+    if (!rebuild && first < m_lines.size())
+        m_movedVertices.insert(m_movedVertices.end(), m_vertices.begin() + start, m_vertices.end());
+
+    m_vertices.resize(first > 0 ? start : 0);
+    if (first == 0)
+        m_firstVertex = 0;
 
-    temp.setString(string.substring(localPos, 1));
-    m_texts.insert(m_texts.begin() + index, temp);
-    
-    if (localPos != 0)
+    // Lines are drawn in a single call, so their position is baked into
+    // their vertices. Lines that only moved are moved by as much, the
+    // others are built again.
+    for (std::size_t i = first; i < m_lines.size(); ++i)
     {
-        temp.setString(string.substring(0, localPos));
-        m_texts.insert(m_texts.begin() + index, temp);
+        const Line &line = m_lines[i];
+        float top = getLineTop(i);
+        std::size_t offset = m_vertices.size();
+
+        if (rebuild || line.m_verticesNeedUpdate)
+        {
+            line.appendVertices(m_vertices, sf::Vector2f(0.f, top));
+        }
+        else
+        {
+            auto begin = m_movedVertices.begin() + (line.m_vertexOffset - start);
+            m_vertices.insert(m_vertices.end(), begin, begin + line.m_vertexCount);
+
+            float delta = top - line.m_vertexTop;
+            if (delta != 0.f)
+            {
+                for (std::size_t j = offset; j < m_vertices.size(); ++j)
+                    m_vertices[j].position.y += delta;
+            }
+        }
+
+        line.m_vertexOffset = offset;
+        line.m_vertexCount = m_vertices.size() - offset;
+        line.m_vertexTop = top;
+        line.m_verticesNeedUpdate = false;
     }
+
+    m_firstMovedLine = std::u32string::npos;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::Line::updateGeometry() const
+void RichText::ensureBoundsUpdate() const
 {
+    // Do nothing, if bounds are up to date
+    if (!m_boundsNeedUpdate)
+        return;
+
+    m_boundsNeedUpdate = false;
+
     m_bounds = sf::FloatRect();
+    for (const Line &line : m_lines)
+        m_bounds.width = std::max(m_bounds.width, line.getLocalBounds().width);
 
-    for (sf::Text& text : m_texts)
-        updateTextAndGeometry(text);
+    m_bounds.height = getLineTop(m_lines.size()) - getTop();
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::Line::updateTextAndGeometry(sf::Text& text) const
+DistanceFieldFont::DistanceFieldFont(const sf::Font &font, unsigned int baseSize, unsigned int spread)
+    : m_font(font),
+      m_baseSize(baseSize),
+      m_spread(spread),
+      m_nextRow(4),
+      m_size(1024, 256),
+      m_textureNeedsUpdate(true)
 {
-    // Set text offset
-    text.setPosition(m_bounds.width, 0.f);
+    // White pixels, with the field in the alpha channel. The top left
+    // corner is solid, for underlines and strike through lines.
+    m_pixels.resize(m_size.x * m_size.y * 4);
+    for (std::size_t i = 0; i < m_pixels.size(); i += 4)
+    {
+        m_pixels[i] = m_pixels[i + 1] = m_pixels[i + 2] = 255;
+        m_pixels[i + 3] = 0;
+    }
 
-    // Update bounds
-    float lineSpacing = std::floor(text.getFont()->getLineSpacing(text.getCharacterSize()));
-    m_bounds.height = std::max(m_bounds.height, lineSpacing);
-    m_bounds.width += text.getGlobalBounds().width;
+    for (unsigned int y = 0; y < 4; ++y)
+        for (unsigned int x = 0; x < 4; ++x)
+            m_pixels[(y * m_size.x + x) * 4 + 3] = 255;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-RichText::RichText()
-    : RichText(nullptr)
+bool DistanceFieldFont::isAvailable()
 {
-
+    return sf::Shader::isAvailable();
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-RichText::RichText(const sf::Font& font)
-    : RichText(&font)
+const sf::Font &DistanceFieldFont::getFont() const
 {
-
+    return m_font;
 }
 
+
 ////////////////////////////////////////////////////////////////////////////////
-RichText& RichText::operator << (const TextStroke& stroke)
+unsigned int DistanceFieldFont::getBaseSize() const
 {
-    m_currentStroke = stroke;
-    return *this;
+    return m_baseSize;
 }
 
-RichText& RichText::operator << (const Outline& outline)
-{
-    m_currentStroke.outline = outline.outline;
-    m_currentStroke.thickness = outline.thickness;
-    return *this;
-}
 
 ////////////////////////////////////////////////////////////////////////////////
-RichText & RichText::operator << (const sf::Color& color)
+unsigned int DistanceFieldFont::getSpread() const
 {
-    m_currentStroke.fill = color;
-    return *this;
+    return m_spread;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-RichText & RichText::operator << (sf::Text::Style style)
+const DistanceFieldFont::Glyph &DistanceFieldFont::getGlyph(sf::Uint32 character, bool bold) const
 {
-    m_currentStyle = style;
-    return *this;
+    std::uint64_t key = (std::uint64_t(bold) << 32) | character;
+
+    // Elements of an unordered_map don't move, so the reference stays
+    // valid after the lock is released
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_glyphs.find(key);
+    if (it != m_glyphs.end())
+        return it->second;
+
+    // Rasterise the glyph at the base size, and make room for its field
+    const sf::Glyph &source = FontMetrics::get(m_font, m_baseSize).getGlyph(character, bold);
+
+    Glyph glyph;
+    glyph.bounds = source.bounds;
+    glyph.sourceRect = source.textureRect;
+    if (source.textureRect.width > 0 && source.textureRect.height > 0)
+    {
+        glyph.textureRect = findGlyphRect(source.textureRect.width + 2 * m_spread,
+                                          source.textureRect.height + 2 * m_spread);
+        if (glyph.textureRect.width > 0)
+            m_pendingGlyphs.push_back(key);
+    }
+
+    return m_glyphs.emplace(key, glyph).first->second;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-std::vector<sf::String> explode(const sf::String& string, sf::Uint32 delimiter)
+const sf::Texture &DistanceFieldFont::getTexture() const
 {
-    if (string.isEmpty())
-        return std::vector<sf::String>();
+    std::lock_guard<std::mutex> lock(m_mutex);
 
-    // For each character in the string
-    std::vector<sf::String> result;
-    sf::String buffer;
-    for (sf::Uint32 character : string) {
-        // If we've hit the delimiter character
-        if (character == delimiter) {
-            // Add them to the result vector
-            result.push_back(buffer);
-            buffer.clear();
-        } else {
-            // Accumulate the next character into the sequence
-            buffer += character;
+    // Read the font texture back once for every glyph added since last time
+    if (!m_pendingGlyphs.empty())
+    {
+        sf::Image source = FontMetrics::get(m_font, m_baseSize).copyTexture();
+        for (std::uint64_t key : m_pendingGlyphs)
+        {
+            const Glyph &glyph = m_glyphs[key];
+            renderDistanceField(source, glyph.sourceRect, m_pixels, m_size.x,
+                                glyph.textureRect, m_spread);
         }
+
+        m_pendingGlyphs.clear();
+        m_textureNeedsUpdate = true;
     }
 
-    // Add to the result if buffer still has contents or if the last character is a delimiter
-    if (!buffer.isEmpty() || string[string.getSize() - 1] == delimiter)
-        result.push_back(buffer);
+    if (m_textureNeedsUpdate)
+    {
+        if (m_texture.getSize() != m_size)
+        {
+            m_texture.create(m_size.x, m_size.y);
+            m_texture.setSmooth(true);
+        }
+
+        m_texture.update(m_pixels.data(), m_size.x, m_size.y, 0, 0);
+        m_textureNeedsUpdate = false;
+    }
 
-    return result;
+    return m_texture;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-RichText & RichText::operator << (const sf::String& string)
+sf::IntRect DistanceFieldFont::findGlyphRect(unsigned int width, unsigned int height) const
 {
-    // Maybe skip
-    if (string.isEmpty())
-        return *this;
-
-    // Explode into substrings
-    std::vector<sf::String> subStrings = explode(string, '\n');
+    // Find the row that fits the glyph best, like sf::Font does
+    Row *row = nullptr;
+    float bestRatio = 0.f;
+    for (Row &candidate : m_rows)
+    {
+        float ratio = static_cast<float>(height) / candidate.height;
+        if (ratio < 0.7f || ratio > 1.f || candidate.width + width > m_size.x)
+            continue;
 
-    // Append first substring using the last line
-    auto it = subStrings.begin();
-    if (it != subStrings.end()) {
-        // If there isn't any line, just create it
-        if (m_lines.empty())
-            m_lines.resize(1);
+        if (ratio > bestRatio)
+        {
+            row = &candidate;
+            bestRatio = ratio;
+        }
+    }
 
-        // Remove last line's height
-        Line &line = m_lines.back();
-        m_bounds.height -= line.getGlobalBounds().height;
+    // Otherwise start a new row, growing the atlas if needed. Its width
+    // can't go past the stride the outline level is stored with.
+    if (!row)
+    {
+        unsigned int maxSize = sf::Texture::getMaximumSize();
+        unsigned int maxWidth = std::min(maxSize, static_cast<unsigned int>(DistanceFieldLevelStride));
+        unsigned int rowHeight = height + height / 10;
+        if (width > maxWidth || m_nextRow + rowHeight > maxSize)
+        {
+            sf::err() << "Failed to add a glyph to the distance field atlas: no more room" << std::endl;
+            return sf::IntRect();
+        }
 
-        // Append text
-        line.appendText(createText(*it));
+        sf::Vector2u size = m_size;
+        while (size.x < width)
+            size.x *= 2;
+        while (m_nextRow + rowHeight > size.y)
+            size.y *= 2;
+        resize(sf::Vector2u(std::min(size.x, maxWidth), std::min(size.y, maxSize)));
 
-        // Update bounds
-        m_bounds.height += line.getGlobalBounds().height;
-        m_bounds.width = std::max(m_bounds.width, line.getGlobalBounds().width);
+        m_rows.push_back(Row{m_nextRow, 0, rowHeight});
+        m_nextRow += rowHeight;
+        row = &m_rows.back();
     }
 
-    // Append the rest of substrings as new lines
-    while (++it != subStrings.end()) {
-        Line line;
-        line.setPosition(0.f, m_bounds.height);
-        line.appendText(createText(*it));
-        m_lines.push_back(std::move(line));
+    // Leave a pixel between glyphs, so that they don't bleed into each other
+    sf::IntRect rect(row->width, row->top, width, height);
+    row->width += width + 1;
 
-        // Update bounds
-        m_bounds.height += line.getGlobalBounds().height;
-        m_bounds.width = std::max(m_bounds.width, line.getGlobalBounds().width);
-    }
-
-    // Return
-    return *this;
+    return rect;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::setCharacterColor(std::size_t line, std::size_t pos, sf::Color color)
+void DistanceFieldFont::resize(sf::Vector2u size) const
 {
-    assert(line < m_lines.size());
-    m_lines[line].setCharacterColor(pos, color);
-    updateGeometry();
+    // Maybe skip
+    if (size == m_size)
+        return;
+
+    // New pixels are white and outside of every glyph
+    std::vector<sf::Uint8> pixels(size.x * size.y * 4, 255);
+    for (std::size_t i = 3; i < pixels.size(); i += 4)
+        pixels[i] = 0;
+
+    for (unsigned int y = 0; y < m_size.y; ++y)
+    {
+        std::copy(m_pixels.begin() + y * m_size.x * 4, m_pixels.begin() + (y + 1) * m_size.x * 4,
+                  pixels.begin() + y * size.x * 4);
+    }
+
+    m_pixels.swap(pixels);
+    m_size = size;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::setCharacterStyle(std::size_t line, std::size_t pos, sf::Text::Style style)
+bool operator ==(const GlyphSet &left, const GlyphSet &right)
 {
-    assert(line < m_lines.size());
-    m_lines[line].setCharacterStyle(pos, style);
-    updateGeometry();
+    return left.characterSize == right.characterSize &&
+           left.bold == right.bold &&
+           left.outlineThickness == right.outlineThickness;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::setCharacter(std::size_t line, std::size_t pos, sf::Uint32 character)
+bool operator <(const GlyphSet &left, const GlyphSet &right)
 {
-    assert(line < m_lines.size());
-    m_lines[line].setCharacter(pos, character);
-    updateGeometry();
+    return std::tie(left.characterSize, left.bold, left.outlineThickness) <
+           std::tie(right.characterSize, right.bold, right.outlineThickness);
 }
 
+
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::setCharacterSize(unsigned int size)
+RichTextDocument::RichTextDocument()
+    : m_font(nullptr),
+      m_distanceField(nullptr),
+      m_characterSize(30)
 {
-    // Maybe skip
-    if (m_characterSize == size)
-        return;
 
-    // Update character size
-    m_characterSize = size;
-
-    // Set texts character size
-    for (Line &line : m_lines)
-        line.setCharacterSize(size);
-
-    updateGeometry();
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::setFont(const sf::Font& font)
+const sf::FloatRect &RichTextDocument::getLocalBounds() const
 {
-    // Maybe skip
-    if (m_font == &font)
-        return;
-
-    // Update font
-    m_font = &font;
-
-    // Set texts font
-    for (Line &line : m_lines)
-        line.setFont(font);
-
-    updateGeometry();
+    return m_bounds;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::clear()
+std::size_t RichTextDocument::getVertexCount() const
 {
-    // Clear texts
-    m_lines.clear();
-
-    // Reset bounds
-    m_bounds = sf::FloatRect();
+    return m_vertices.size();
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-sf::Color RichText::getCharacterColor(std::size_t line, std::size_t pos) const
+RichTextInstance::RichTextInstance()
+    : m_color(sf::Color::White)
 {
-    assert(line < m_lines.size());
-    return m_lines[line].getCharacterColor(pos);
+
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-sf::Uint32 RichText::getCharacterStyle(std::size_t line, std::size_t pos) const
+RichTextInstance::RichTextInstance(std::shared_ptr<const RichTextDocument> document)
+    : m_document(std::move(document)),
+      m_color(sf::Color::White)
 {
-    assert(line < m_lines.size());
-    return m_lines[line].getCharacterStyle(pos);
+
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-sf::Uint32 RichText::getCharacter(std::size_t line, std::size_t pos) const
+void RichTextInstance::setDocument(std::shared_ptr<const RichTextDocument> document)
 {
-    assert(line < m_lines.size());
-    return m_lines[line].getCharacter(pos);
+    m_document = std::move(document);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-const std::vector<RichText::Line> &RichText::getLines() const
+void RichTextInstance::setColor(const sf::Color &color)
 {
-    return m_lines;
+    m_color = color;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-unsigned int RichText::getCharacterSize() const
+const std::shared_ptr<const RichTextDocument> &RichTextInstance::getDocument() const
 {
-    return m_characterSize;
+    return m_document;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-const sf::Font *RichText::getFont() const
+const sf::Color &RichTextInstance::getColor() const
 {
-    return m_font;
+    return m_color;
 }
 
 
-////////////////////////////////////////////////////////////
-sf::FloatRect RichText::getLocalBounds() const
+////////////////////////////////////////////////////////////////////////////////
+sf::FloatRect RichTextInstance::getLocalBounds() const
 {
-    return m_bounds;
+    return m_document ? m_document->getLocalBounds() : sf::FloatRect();
 }
 
 
-////////////////////////////////////////////////////////////
-sf::FloatRect RichText::getGlobalBounds() const
+////////////////////////////////////////////////////////////////////////////////
+sf::FloatRect RichTextInstance::getGlobalBounds() const
 {
     return getTransform().transformRect(getLocalBounds());
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::draw(sf::RenderTarget& target, sf::RenderStates states) const
+void RichTextInstance::drawAll(sf::RenderTarget &target, const std::vector<const RichTextInstance *> &instances,
+                               sf::RenderStates states)
 {
-    states.transform *= getTransform();
-
-    for (const Line &line : m_lines)
-        target.draw(line, states);
+    drawAll(target, instances.data(), instances.size(), states);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-RichText::RichText(const sf::Font* font)
-    : m_font(font),
-      m_characterSize(30),
-      m_currentStroke{ sf::Color::White, sf::Color::Transparent },
-      m_currentStyle(sf::Text::Regular)
+void RichTextInstance::draw(sf::RenderTarget &target, sf::RenderStates states) const
 {
+    // Nothing to draw without a font
+    if (!m_document || !m_document->m_font || m_document->m_vertices.empty())
+        return;
+
+    // Tinted instances need their own vertices
+    if (m_color != sf::Color::White)
+    {
+        const RichTextInstance *instance = this;
+        drawAll(target, &instance, 1, states);
+        return;
+    }
 
+    const RichTextDocument &document = *m_document;
+    states.transform *= getTransform();
+    setGlyphStates(states, *document.m_font, document.m_characterSize, document.m_distanceField);
+    target.draw(document.m_vertices.data(), document.m_vertices.size(), sf::Triangles, states);
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-sf::Text RichText::createText(const sf::String& string) const
+void RichTextInstance::drawAll(sf::RenderTarget &target, const RichTextInstance *const *instances,
+                               std::size_t count, sf::RenderStates states)
 {
-    sf::Text text;
-    text.setString(string);
-    text.setFillColor(m_currentStroke.fill);
-    text.setOutlineColor(m_currentStroke.outline);
-    text.setOutlineThickness(m_currentStroke.thickness);
-    text.setStyle(m_currentStyle);
-    text.setCharacterSize(m_characterSize);
-    if (m_font)
-        text.setFont(*m_font);
+    SFE_RICHTEXT_PROFILE("RichTextInstance::drawAll");
+
+    // Find the visible area, in the coordinates of the instances
+    const sf::View &view = target.getView();
+    sf::FloatRect visible = view.getInverseTransform().transformRect(sf::FloatRect(-1.f, -1.f, 2.f, 2.f));
+    visible = states.transform.getInverse().transformRect(visible);
 
-    return text;
+    // Reused from one call to the next, so that batching doesn't allocate
+    thread_local std::vector<sf::Vertex> vertices;
+    vertices.clear();
+
+    // Document of the batch being built, whose glyph states it is drawn with
+    const RichTextDocument *batch = nullptr;
+    auto flush = [&]()
+    {
+        if (vertices.empty())
+            return;
+
+        sf::RenderStates batchStates = states;
+        setGlyphStates(batchStates, *batch->m_font, batch->m_characterSize, batch->m_distanceField);
+        target.draw(vertices.data(), vertices.size(), sf::Triangles, batchStates);
+        vertices.clear();
+    };
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const RichTextInstance &instance = *instances[i];
+        const RichTextDocument *document = instance.m_document.get();
+        if (!document || !document->m_font || document->m_vertices.empty())
+            continue;
+
+        if (!instance.getGlobalBounds().intersects(visible))
+            continue;
+
+        // Distance field fonts draw every size from the same atlas
+        bool sameGlyphs = batch && (batch->m_distanceField || document->m_distanceField
+            ? batch->m_distanceField == document->m_distanceField
+            : batch->m_font == document->m_font && batch->m_characterSize == document->m_characterSize);
+        if (!sameGlyphs)
+            flush();
+        batch = document;
+
+        const sf::Transform &transform = instance.getTransform();
+        for (const sf::Vertex &vertex : document->m_vertices)
+        {
+            vertices.push_back(sf::Vertex(transform.transformPoint(vertex.position),
+                                          vertex.color * instance.m_color, vertex.texCoords));
+        }
+    }
+
+    flush();
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
-void RichText::updateGeometry() const
+RichTextLayout measure(const sf::Font &font, std::u32string_view string,
+                       unsigned int characterSize, float maxWidth)
 {
-    m_bounds = sf::FloatRect();
+    return RichText::measureLines(font, string.begin(), string.end(), characterSize, maxWidth);
+}
 
-    for (Line &line : m_lines) {
-        line.setPosition(0.f, m_bounds.height);
 
-        m_bounds.height += line.getGlobalBounds().height;
-        m_bounds.width = std::max(m_bounds.width, line.getGlobalBounds().width);
-    }
+////////////////////////////////////////////////////////////////////////////////
+RichTextLayout measure(const sf::Font &font, std::string_view string,
+                       unsigned int characterSize, float maxWidth)
+{
+    return RichText::measureLines(font, string.begin(), string.end(), characterSize, maxWidth);
 }
 
 }
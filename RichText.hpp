@@ -3,12 +3,24 @@
 //////////////////////////////////////////////////////////////////////////
 // Headers
 //////////////////////////////////////////////////////////////////////////
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include <SFML/Graphics/Transformable.hpp>
 #include <SFML/Graphics/Drawable.hpp>
 #include <SFML/Graphics/Color.hpp>
 #include <SFML/Graphics/Text.hpp>
+#include <SFML/Graphics/Texture.hpp>
+#include <SFML/Graphics/Vertex.hpp>
 
 #include <SFML/System/Vector2.hpp>
 
@@ -35,6 +47,247 @@ struct Outline
     float thickness = 0.f;
 };
 
+//////////////////////////////////////////////////////////////////////////////
+// Styled text known at compile time, e.g. for static labels:
+//
+//     constexpr sfe::StaticRun title[] = {
+//         { U"Start ", 0xffffffff, sf::Text::Bold },
+//         { U"game", 0x00ffffff },
+//     };
+//     text.append(title);
+//
+// Colors are packed as 0xRRGGBBAA, like sf::Color::toInteger(), because
+// sf::Color can't be used in constant expressions.
+//////////////////////////////////////////////////////////////////////////////
+struct StaticRun
+{
+    std::u32string_view string;                 ///< Characters, '\n' starts a new line
+    sf::Uint32 fill = 0xffffffff;               ///< Fill color
+    sf::Uint32 style = sf::Text::Regular;       ///< sf::Text::Style flags
+    sf::Uint32 outline = 0x00000000;            ///< Outline color
+    float thickness = 0.f;                      ///< Outline thickness
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Markup parsed once, to be appended to texts many times. Supported tags are
+// [b], [i], [u], [s], [color=...] and [outline=...] or [outline=...,2], each
+// closed by [/b], [/color], etc. Colors are #rgb, #rrggbb, #rrggbbaa or a
+// name such as red. {0}, {1}, etc. are placeholders for the arguments given
+// when appending. [[ and {{ stand for [ and {. Unknown tags are kept as text.
+// Markup starts white and regular, whatever the current stroke and style of
+// the text it is appended to.
+//////////////////////////////////////////////////////////////////////////////
+class Markup
+{
+public:
+    //////////////////////////////////////////////////////////////////////////
+    // Parse UTF-8 markup
+    //////////////////////////////////////////////////////////////////////////
+    explicit Markup(std::string_view markup);
+
+private:
+    //////////////////////////////////////////////////////////////////////////
+    // Text between two tags, or a placeholder
+    //////////////////////////////////////////////////////////////////////////
+    struct Segment
+    {
+        std::size_t offset = 0;                     ///< First byte of the text
+        std::size_t length = 0;                     ///< Number of bytes of the text
+        std::size_t argument = std::string::npos;   ///< Index of the argument, npos for text
+        TextStroke stroke;                          ///< Fill, outline and thickness
+        sf::Uint32 style = 0;                       ///< sf::Text::Style flags
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // Member data
+    //////////////////////////////////////////////////////////////////////////
+    std::string m_text;                             ///< Text of every segment, without tags
+    std::vector<Segment> m_segments;                ///< Segments, in order
+
+    friend class RichText;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Result of laying out a text: where each line, run and character goes, in
+// the local coordinates of the text. Rows of wrapped lines are laid out one
+// below the other inside their line.
+//////////////////////////////////////////////////////////////////////////////
+struct RichTextLayout
+{
+    struct Glyph
+    {
+        sf::Uint32 character = 0;           ///< Character
+        sf::Vector2f position;              ///< Pen position, at the top of the row
+    };
+
+    struct Run
+    {
+        std::size_t line = 0;               ///< Index of the line
+        std::size_t offset = 0;             ///< First character, in the line
+        std::size_t length = 0;             ///< Number of characters
+        sf::FloatRect bounds;               ///< Box from the pen at the first character to the pen after the last one
+        TextStroke stroke;                  ///< Fill, outline and thickness
+        sf::Uint32 style = 0;               ///< sf::Text::Style flags
+    };
+
+    struct Line
+    {
+        std::size_t firstGlyph = 0;         ///< Index of the first glyph
+        std::size_t glyphCount = 0;         ///< Number of glyphs, one per character
+        std::size_t firstRun = 0;           ///< Index of the first run
+        std::size_t runCount = 0;           ///< Number of runs, a run split by wrapping counts once per row
+        sf::FloatRect bounds;               ///< Box of every row of the line
+    };
+
+    std::vector<Line> lines;                ///< Lines, top to bottom
+    std::vector<Run> runs;                  ///< Runs of every line, split at the end of each row
+    std::vector<Glyph> glyphs;              ///< Glyphs of every line
+    sf::FloatRect bounds;                   ///< Box of every line
+    unsigned int characterSize = 0;         ///< Character size, the baseline is this far below the top of a row
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Glyphs of a font rasterised the same way. sf::Font keeps one texture page
+// per character size, in which each weight and outline thickness gets its
+// own copy of every glyph.
+//////////////////////////////////////////////////////////////////////////////
+struct GlyphSet
+{
+    unsigned int characterSize = 30;        ///< Character size, in pixels
+    bool bold = false;                      ///< Bold glyphs?
+    float outlineThickness = 0.f;           ///< Outline thickness, 0 for the fill
+};
+
+bool operator ==(const GlyphSet &left, const GlyphSet &right);
+bool operator <(const GlyphSet &left, const GlyphSet &right);
+
+//////////////////////////////////////////////////////////////////////////////
+// Signed distance field atlas of a font. Each glyph is rasterised once, at
+// a base size, and a RichText using the atlas draws it with a shader at any
+// character size and outline thickness. Layout uses the advances of the
+// base size, scaled, so resizing a text doesn't rasterise anything.
+// Text drawn with a shader in its render states uses that shader instead of
+// the built-in one, which must then decode the field itself: the atlas is
+// white with the distance in alpha, 0.5 on the edge of the glyph, and the
+// outline level of a quad, in 64ths of the field, is added to its u texture
+// coordinate as a multiple of 8192. The built-in shader draws the edge at
+// 0.5 - level / 64, with level = floor(u / 8192).
+//////////////////////////////////////////////////////////////////////////////
+class DistanceFieldFont
+{
+public:
+    struct Glyph
+    {
+        sf::FloatRect bounds;               ///< Bounds of the glyph at the base size, relative to the baseline
+        sf::IntRect textureRect;            ///< Distance field in the atlas, spread pixels larger than the bounds on each side
+        sf::IntRect sourceRect;             ///< Glyph in the texture of the font
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // Constructor. The distance field of a glyph spreads over spread pixels
+    // around it at the base size, which is also the thickest outline it can
+    // be drawn with, once scaled to the character size of the text.
+    //////////////////////////////////////////////////////////////////////////
+    explicit DistanceFieldFont(const sf::Font &font, unsigned int baseSize = 48,
+                               unsigned int spread = 6);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Can distance field text be drawn? It needs shaders.
+    //////////////////////////////////////////////////////////////////////////
+    static bool isAvailable();
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the font the glyphs are rasterised with
+    //////////////////////////////////////////////////////////////////////////
+    const sf::Font &getFont() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the character size the glyphs are rasterised at
+    //////////////////////////////////////////////////////////////////////////
+    unsigned int getBaseSize() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the distance, in pixels at the base size, covered by the field
+    //////////////////////////////////////////////////////////////////////////
+    unsigned int getSpread() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get a glyph, placing it in the atlas. Its distance field is computed
+    // the next time the texture is requested.
+    //////////////////////////////////////////////////////////////////////////
+    const Glyph &getGlyph(sf::Uint32 character, bool bold) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the atlas, with the distance fields of every glyph requested so
+    // far. Needs an active OpenGL context.
+    //////////////////////////////////////////////////////////////////////////
+    const sf::Texture &getTexture() const;
+
+private:
+    struct Row
+    {
+        unsigned int top;                   ///< Top of the row in the atlas
+        unsigned int width;                 ///< Width used so far
+        unsigned int height;                ///< Height of the row
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // Find room for a glyph in the atlas, growing it if needed. Returns an
+    // empty rect, and the glyph isn't drawn, if it doesn't fit in the
+    // largest atlas.
+    //////////////////////////////////////////////////////////////////////////
+    sf::IntRect findGlyphRect(unsigned int width, unsigned int height) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Grow the atlas, keeping the pixels of the glyphs already in it
+    //////////////////////////////////////////////////////////////////////////
+    void resize(sf::Vector2u size) const;
+
+    const sf::Font &m_font;                             ///< Font
+    unsigned int m_baseSize;                            ///< Character size the glyphs are rasterised at
+    unsigned int m_spread;                              ///< Distance covered by the field, in pixels
+    mutable std::unordered_map<std::uint64_t, Glyph> m_glyphs; ///< Glyphs by character and boldness
+    mutable std::vector<std::uint64_t> m_pendingGlyphs; ///< Glyphs placed in the atlas, without their field yet
+    mutable std::vector<Row> m_rows;                    ///< Rows of glyphs in the atlas
+    mutable unsigned int m_nextRow;                     ///< Top of the next row
+    mutable sf::Vector2u m_size;                        ///< Size of the atlas
+    mutable std::vector<sf::Uint8> m_pixels;            ///< Atlas pixels, the field is in the alpha channel
+    mutable bool m_textureNeedsUpdate;                  ///< Have the pixels changed since the last upload?
+    mutable sf::Texture m_texture;                      ///< Atlas texture
+    mutable std::mutex m_mutex;                         ///< Guards the glyphs and the atlas
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Position of a character in a text
+//////////////////////////////////////////////////////////////////////////////
+struct RichTextPosition
+{
+    std::size_t line = 0;                   ///< Index of the line
+    std::size_t pos = 0;                    ///< Index of the character in the line
+};
+
+class RichTextDocument;
+
+//////////////////////////////////////////////////////////////////////////////
+// Work done by a text. It is only counted when RichText.cpp is compiled with
+// SFE_RICHTEXT_STATS defined, and stays at 0 otherwise, except for the bytes
+// held, which are measured when read. The classes look the same either way,
+// so other files don't need the define. Counting writes to the text while
+// drawing it, so a text counting its work can't be drawn by several threads
+// at once.
+//////////////////////////////////////////////////////////////////////////////
+struct RichTextStats
+{
+    std::size_t textLayouts = 0;            ///< Passes rebuilding vertices of the text
+    std::size_t lineLayouts = 0;            ///< Lines laid out again, from their first changed character
+    std::size_t runSplits = 0;              ///< Runs split to change some of their characters
+    std::size_t runsCreated = 0;            ///< Runs added by appending or splitting
+    std::size_t runsDestroyed = 0;          ///< Runs merged into their neighbours, or dropped with their line
+    std::size_t drawCalls = 0;              ///< Draw calls issued
+    std::size_t verticesDrawn = 0;          ///< Vertices submitted by those calls
+    std::size_t bytesHeld = 0;              ///< Bytes held by the lines, runs, layout and vertices, when read
+};
+
 class RichText : public sf::Drawable, public sf::Transformable
 {
 public:
@@ -44,6 +297,44 @@ public:
     class Line : public sf::Transformable, public sf::Drawable
     {
     public:
+        //////////////////////////////////////////////////////////////////////
+        // Range of characters sharing the same attributes
+        //////////////////////////////////////////////////////////////////////
+        struct Run
+        {
+            std::size_t offset = 0;                ///< Sum of the previous run lengths
+            std::size_t length = 0;                ///< Number of characters
+            TextStroke stroke;                     ///< Fill, outline and thickness
+            sf::Uint32 style = sf::Text::Regular;  ///< sf::Text::Style flags
+        };
+
+        //////////////////////////////////////////////////////////////////////
+        // Allocator of the characters, runs and layout of the line. Lines
+        // of a RichText use the memory resource of the text.
+        //////////////////////////////////////////////////////////////////////
+        using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+        //////////////////////////////////////////////////////////////////////
+        // Constructor
+        //////////////////////////////////////////////////////////////////////
+        Line();
+
+        //////////////////////////////////////////////////////////////////////
+        // Constructor, allocating from the given allocator
+        //////////////////////////////////////////////////////////////////////
+        explicit Line(const allocator_type &allocator);
+
+        //////////////////////////////////////////////////////////////////////
+        // Copy and move constructors, allocating from the given allocator
+        //////////////////////////////////////////////////////////////////////
+        Line(const Line &other, const allocator_type &allocator);
+        Line(Line &&other, const allocator_type &allocator);
+
+        Line(const Line &) = default;
+        Line(Line &&) = default;
+        Line &operator = (const Line &) = default;
+        Line &operator = (Line &&) = default;
+
         //////////////////////////////////////////////////////////////////////
         // Set a character's color.
         // NOTE: Attempting to access a character outside of the line bounds
@@ -51,6 +342,13 @@ public:
         //////////////////////////////////////////////////////////////////////
         void setCharacterColor(std::size_t pos, sf::Color color);
 
+        //////////////////////////////////////////////////////////////////////
+        // Set the color of the characters in [begin, end).
+        // NOTE: Attempting to access a character outside of the line bounds
+        // causes a crash.
+        //////////////////////////////////////////////////////////////////////
+        void setCharacterColor(std::size_t begin, std::size_t end, sf::Color color);
+
         //////////////////////////////////////////////////////////////////////
         // Set a character's style
         // NOTE: Attempting to access a character outside of the line bounds
@@ -58,6 +356,13 @@ public:
         //////////////////////////////////////////////////////////////////////
         void setCharacterStyle(std::size_t pos, sf::Text::Style style);
 
+        //////////////////////////////////////////////////////////////////////
+        // Set the style of the characters in [begin, end).
+        // NOTE: Attempting to access a character outside of the line bounds
+        // causes a crash.
+        //////////////////////////////////////////////////////////////////////
+        void setCharacterStyle(std::size_t begin, std::size_t end, sf::Text::Style style);
+
         //////////////////////////////////////////////////////////////////////
         // Set a character
         // NOTE: Attempting to access a character outside of the line bounds
@@ -75,6 +380,23 @@ public:
         //////////////////////////////////////////////////////////////////////
         void setFont(const sf::Font &font);
 
+        //////////////////////////////////////////////////////////////////////
+        // Set a distance field font, drawn at any size with a shader
+        //////////////////////////////////////////////////////////////////////
+        void setFont(const DistanceFieldFont &font);
+
+        //////////////////////////////////////////////////////////////////////
+        // Set the width past which the line wraps onto a new row, 0 for no
+        // wrapping (the default). Rows break after whitespace, or inside
+        // words longer than a row.
+        //////////////////////////////////////////////////////////////////////
+        void setMaxWidth(float width);
+
+        //////////////////////////////////////////////////////////////////////
+        // Get the width past which the line wraps, 0 if it doesn't
+        //////////////////////////////////////////////////////////////////////
+        float getMaxWidth() const;
+
         //////////////////////////////////////////////////////////////////////
         // Get the length of the line
         //////////////////////////////////////////////////////////////////////
@@ -101,15 +423,71 @@ public:
         //////////////////////////////////////////////////////////////////////
         sf::Uint32 getCharacter(std::size_t pos) const;
 
+        //////////////////////////////////////////////////////////////////////
+        // Get the characters of the line
+        //////////////////////////////////////////////////////////////////////
+        std::u32string_view getString() const;
+
+        //////////////////////////////////////////////////////////////////////
+        // Get the runs of the line, sorted by offset
+        //////////////////////////////////////////////////////////////////////
+        const std::pmr::vector<Run> &getRuns() const;
+
+        //////////////////////////////////////////////////////////////////////
+        // Get the positions of the characters starting a new row because of
+        // wrapping, sorted
+        //////////////////////////////////////////////////////////////////////
+        const std::pmr::vector<std::size_t> &getBreaks() const;
+
         //////////////////////////////////////////////////////////////////////
         // Get texts
+        // NOTE: Deprecated, use getString() and getRuns() instead. This used
+        // to return a reference to texts kept by the line. Texts are now
+        // built from the runs on every call and returned by value. Runs
+        // that wrap are split into one text per row.
         //////////////////////////////////////////////////////////////////////
-        const std::vector<sf::Text> &getTexts() const;
+        [[deprecated("Use getString() and getRuns()")]]
+        std::vector<sf::Text> getTexts() const;
 
         //////////////////////////////////////////////////////////////////////
         // Append text
+        // NOTE: The font and character size of the text replace the ones of
+        // the line.
+        //////////////////////////////////////////////////////////////////////
+        void appendText(const sf::Text &text);
+
+        //////////////////////////////////////////////////////////////////////
+        // Append a string with the given stroke and style
+        //////////////////////////////////////////////////////////////////////
+        void appendText(const sf::String &string, const TextStroke &stroke,
+                        sf::Uint32 style);
+
+        //////////////////////////////////////////////////////////////////////
+        // Insert characters with the given stroke and style before the
+        // pos'th character, or at the end if pos is the length of the line.
+        // The line is laid out again from pos.
+        //////////////////////////////////////////////////////////////////////
+        void insert(std::size_t pos, std::u32string_view string,
+                    const TextStroke &stroke, sf::Uint32 style);
+
         //////////////////////////////////////////////////////////////////////
-        void appendText(sf::Text text);
+        // Erase up to count characters from the pos'th one
+        //////////////////////////////////////////////////////////////////////
+        void erase(std::size_t pos, std::size_t count);
+
+        //////////////////////////////////////////////////////////////////////
+        // Get the character at a point, in local coordinates. Points past
+        // the end of a row give its last character, or the length of the
+        // line past the end of the last row.
+        //////////////////////////////////////////////////////////////////////
+        std::size_t hitTest(sf::Vector2f point) const;
+
+        //////////////////////////////////////////////////////////////////////
+        // Get the box of a character, from the pen before it to the pen
+        // after it and as high as its row, in local coordinates. pos may be
+        // the length of the line, for a caret at its end.
+        //////////////////////////////////////////////////////////////////////
+        sf::FloatRect getCharacterRect(std::size_t pos) const;
 
         //////////////////////////////////////////////////////////////////////
         // Get local bounds
@@ -129,32 +507,131 @@ public:
 
     private:
         //////////////////////////////////////////////////////////////////////
-        // Get the index of the sf::Text containing the pos'th character.
-        // Also changes pos to the position of the character in the sf::Text.
+        // Append characters with the given stroke and style. Iterators
+        // over char are decoded as UTF-8, other ones are copied as UTF-32.
+        //////////////////////////////////////////////////////////////////////
+        template <typename Iterator>
+        void appendCharacters(Iterator begin, Iterator end,
+                              const TextStroke &stroke, sf::Uint32 style);
+
+        //////////////////////////////////////////////////////////////////////
+        // Append the characters of another line from pos on, with their
+        // stroke and style
+        //////////////////////////////////////////////////////////////////////
+        void appendCharacters(const Line &line, std::size_t pos);
+
+        //////////////////////////////////////////////////////////////////////
+        // Get the index of the run containing the pos'th character.
+        // Also changes pos to the position of the character in the run.
+        // Runs are binary searched by offset, so this is O(log runs).
         //////////////////////////////////////////////////////////////////////
         std::size_t convertLinePosToLocal(std::size_t &pos) const;
 
         //////////////////////////////////////////////////////////////////////
-        // Split a string to isolate the given character
-        // into a string of its own for individual formatting
+        // Split the run containing the given character so that a run starts
+        // at it. Returns the index of that run, or the number of runs if pos
+        // is the length of the line.
         //////////////////////////////////////////////////////////////////////
-        void isolateCharacter(std::size_t pos);
+        std::size_t splitRun(std::size_t pos);
 
         //////////////////////////////////////////////////////////////////////
-        // Update geometry
+        // Merge the runs in [first, last) and their neighbours when they
+        // share the same attributes
         //////////////////////////////////////////////////////////////////////
-        void updateGeometry() const;
+        void mergeRuns(std::size_t first, std::size_t last);
 
         //////////////////////////////////////////////////////////////////////
-        // Update geometry for a given text
+        // Mark the geometry of the characters from the given position to the
+        // end of the line as outdated
         //////////////////////////////////////////////////////////////////////
-        void updateTextAndGeometry(sf::Text &text) const;
+        void invalidateGeometry(std::size_t pos);
+
+        //////////////////////////////////////////////////////////////////////
+        // Update geometry if it is outdated
+        //////////////////////////////////////////////////////////////////////
+        void ensureGeometryUpdate() const;
+
+        //////////////////////////////////////////////////////////////////////
+        // Update geometry of the characters from the given position to the
+        // end of the line
+        //////////////////////////////////////////////////////////////////////
+        void updateGeometry(std::size_t pos = 0) const;
+
+        //////////////////////////////////////////////////////////////////////
+        // Find where the line wraps, and update the bounds
+        //////////////////////////////////////////////////////////////////////
+        void updateBreaks() const;
+
+        //////////////////////////////////////////////////////////////////////
+        // Get the height of a row
+        //////////////////////////////////////////////////////////////////////
+        float getRowHeight() const;
+
+        //////////////////////////////////////////////////////////////////////
+        // Call function(part, row, rowStart) for the part of each run on
+        // each row, in order
+        //////////////////////////////////////////////////////////////////////
+        template <typename Function>
+        void forEachRunRow(Function function) const;
+
+        //////////////////////////////////////////////////////////////////////
+        // Append the glyph quads of every run to a vertex array, outlines
+        // first so that fills are drawn on top of them. Quads are in local
+        // coordinates, moved by offset.
+        //////////////////////////////////////////////////////////////////////
+        void appendVertices(std::pmr::vector<sf::Vertex> &vertices, sf::Vector2f offset) const;
+
+        //////////////////////////////////////////////////////////////////////
+        // Append the boxes of the line, its runs and its characters to a
+        // layout, with the line at the given vertical position
+        //////////////////////////////////////////////////////////////////////
+        void appendLayout(RichTextLayout &layout, std::size_t index, float top) const;
 
         //////////////////////////////////////////////////////////////////////
         // Member data
         //////////////////////////////////////////////////////////////////////
-        mutable std::vector<sf::Text> m_texts; ///< List of texts
-        mutable sf::FloatRect m_bounds;        ///< Local bounds
+        std::pmr::u32string m_string;           ///< Characters of the line
+        std::pmr::vector<Run> m_runs;           ///< Attributes of the characters
+        const sf::Font *m_font;                 ///< Font
+        const DistanceFieldFont *m_distanceField; ///< Distance field atlas of the font, if drawn with one
+        unsigned int m_characterSize;           ///< Character size
+        float m_maxWidth;                       ///< Width past which the line wraps, 0 for no wrapping
+        mutable std::pmr::vector<float> m_positions; ///< Horizontal position of each character, and of the end of the line, as if it didn't wrap
+        mutable std::pmr::vector<std::size_t> m_breaks; ///< First character of each row but the first one
+        mutable bool m_breaksNeedUpdate;        ///< Do the breaks need to be recomputed?
+        mutable sf::FloatRect m_bounds;         ///< Local bounds
+        mutable std::size_t m_geometryStart;    ///< First character whose geometry is outdated
+        mutable std::size_t m_vertexOffset;     ///< First vertex of the line in the RichText vertex array
+        mutable std::size_t m_vertexCount;      ///< Number of vertices of the line in the RichText vertex array
+        mutable float m_vertexTop;              ///< Vertical position the line had when its vertices were built
+        mutable bool m_verticesNeedUpdate;      ///< Do the vertices of the line need to be rebuilt?
+        mutable RichTextStats m_stats;          ///< Work done by the line
+
+        friend class RichText;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // Scoped batch of edits: calls beginEdit() on construction and endEdit()
+    // on destruction
+    //////////////////////////////////////////////////////////////////////////
+    class Batch
+    {
+    public:
+        //////////////////////////////////////////////////////////////////////
+        // Constructor
+        //////////////////////////////////////////////////////////////////////
+        explicit Batch(RichText &text);
+
+        //////////////////////////////////////////////////////////////////////
+        // Destructor
+        //////////////////////////////////////////////////////////////////////
+        ~Batch();
+
+        Batch(const Batch &) = delete;
+        Batch &operator = (const Batch &) = delete;
+
+    private:
+        RichText &m_text; ///< Edited text
     };
 
     //////////////////////////////////////////////////////////////////////////
@@ -167,6 +644,13 @@ public:
     //////////////////////////////////////////////////////////////////////////
     RichText(const sf::Font &font);
 
+    //////////////////////////////////////////////////////////////////////////
+    // Constructor, taking every line, character, run and vertex from the
+    // given memory resource, e.g. a std::pmr::monotonic_buffer_resource
+    // released once per frame. The resource must outlive the text.
+    //////////////////////////////////////////////////////////////////////////
+    RichText(const sf::Font &font, std::pmr::memory_resource *resource);
+
     //////////////////////////////////////////////////////////////////////////
     // Operators
     //////////////////////////////////////////////////////////////////////////
@@ -176,24 +660,105 @@ public:
     RichText & operator << (sf::Text::Style style);
     RichText & operator << (const sf::String &string);
 
+    //////////////////////////////////////////////////////////////////////////
+    // Append UTF-32 text, splitting lines on '\n'.
+    // Characters are copied straight into the line storage.
+    //////////////////////////////////////////////////////////////////////////
+    RichText & append(std::u32string_view string);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Append UTF-8 text, splitting lines on '\n'.
+    // Characters are decoded straight into the line storage.
+    //////////////////////////////////////////////////////////////////////////
+    RichText & append(std::string_view string);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Append parsed markup, with each {n} replaced by the n'th argument.
+    // Arguments are appended as plain text, tags in them aren't parsed.
+    //////////////////////////////////////////////////////////////////////////
+    RichText & append(const Markup &markup, std::initializer_list<std::string_view> arguments = {});
+
+    //////////////////////////////////////////////////////////////////////////
+    // Parse UTF-8 markup and append it, in a single pass. See Markup for the
+    // supported tags. Braces are plain text here.
+    //////////////////////////////////////////////////////////////////////////
+    RichText & appendMarkup(std::string_view markup);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Append runs declared at compile time. Their characters are copied as
+    // is, there is nothing to decode or parse.
+    //////////////////////////////////////////////////////////////////////////
+    RichText & append(const StaticRun *runs, std::size_t count);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Append an array of runs declared at compile time
+    //////////////////////////////////////////////////////////////////////////
+    template <std::size_t Count>
+    RichText & append(const StaticRun (&runs)[Count])
+    {
+        return append(runs, Count);
+    }
+
     //////////////////////////////////////////////////////////////////////////
     // Set the color of a character.
     // Attempting to access a character outside of the bounds causes a crash.
     //////////////////////////////////////////////////////////////////////////
     void setCharacterColor(std::size_t line, std::size_t pos, sf::Color color);
 
+    //////////////////////////////////////////////////////////////////////////
+    // Set the color of the characters in [begin, end) of a line.
+    // Attempting to access a character outside of the bounds causes a crash.
+    //////////////////////////////////////////////////////////////////////////
+    void setCharacterColor(std::size_t line, std::size_t begin, std::size_t end, sf::Color color);
+
     //////////////////////////////////////////////////////////////////////////
     // Set the style of a character.
     // Attempting to access a character outside of the bounds causes a crash.
     //////////////////////////////////////////////////////////////////////////
     void setCharacterStyle(std::size_t line, std::size_t pos, sf::Text::Style style);
 
+    //////////////////////////////////////////////////////////////////////////
+    // Set the style of the characters in [begin, end) of a line.
+    // Attempting to access a character outside of the bounds causes a crash.
+    //////////////////////////////////////////////////////////////////////////
+    void setCharacterStyle(std::size_t line, std::size_t begin, std::size_t end, sf::Text::Style style);
+
     //////////////////////////////////////////////////////////////////////////
     // Set a character
     // Attempting to access a character outside of the bounds causes a crash.
     //////////////////////////////////////////////////////////////////////////
     void setCharacter(std::size_t line, std::size_t pos, sf::Uint32 character);
 
+    //////////////////////////////////////////////////////////////////////////
+    // Insert characters before the pos'th character of a line, or at its
+    // end if pos is its length, with the stroke and style of the character
+    // before them (after them at the start of a line, the current ones in an
+    // empty line). Each '\n' splits the line in two. Only the edited lines
+    // are laid out again.
+    // Attempting to access a character outside of the bounds causes a crash.
+    //////////////////////////////////////////////////////////////////////////
+    void insert(std::size_t line, std::size_t pos, std::u32string_view string);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Insert UTF-8 characters before the pos'th character of a line
+    //////////////////////////////////////////////////////////////////////////
+    void insert(std::size_t line, std::size_t pos, std::string_view string);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Insert characters before the pos'th character of a line, with the
+    // given stroke and style
+    //////////////////////////////////////////////////////////////////////////
+    void insert(std::size_t line, std::size_t pos, std::u32string_view string,
+                const TextStroke &stroke, sf::Uint32 style);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Erase up to count characters from the pos'th character of a line. The
+    // end of a line counts as one character, erasing it joins the line with
+    // the next one.
+    // Attempting to access a character outside of the bounds causes a crash.
+    //////////////////////////////////////////////////////////////////////////
+    void erase(std::size_t line, std::size_t pos, std::size_t count);
+
     //////////////////////////////////////////////////////////////////////////
     // Set character size
     //////////////////////////////////////////////////////////////////////////
@@ -205,10 +770,120 @@ public:
     void setFont(const sf::Font &font);
 
     //////////////////////////////////////////////////////////////////////////
-    // Clear
+    // Set a distance field font. Its glyphs are drawn from one atlas at any
+    // character size, so zooming or resizing the text stays sharp and
+    // doesn't rasterise new glyphs. Outlines are drawn by the shader too.
+    // A shader set in the render states replaces the built-in one, see
+    // DistanceFieldFont.
+    //////////////////////////////////////////////////////////////////////////
+    void setFont(const DistanceFieldFont &font);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Clear, and release the vertices. Call reserve() again before refilling
+    // the text to avoid growing them step by step.
     //////////////////////////////////////////////////////////////////////////
     void clear();
 
+    //////////////////////////////////////////////////////////////////////////
+    // Reserve storage for a text of the given number of lines and
+    // characters, so that building and editing it doesn't grow the vertex
+    // array and the bookkeeping of edited lines step by step. Lines
+    // themselves are kept in a std::deque, which allocates them in blocks.
+    //////////////////////////////////////////////////////////////////////////
+    void reserve(std::size_t lines, std::size_t characters);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Save the characters and runs of every line in a compact binary
+    // format, along with their layout unless withLayout is false. The
+    // layout is keyed by the font it was computed with: its family, line
+    // spacing and a sample of its advances at the character size. Numbers
+    // are stored in the byte order of the machine. Returns false if the
+    // text has more than 2^32 characters.
+    //////////////////////////////////////////////////////////////////////////
+    bool saveToMemory(std::vector<sf::Uint8> &output, bool withLayout = true) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Save the text to a file, see saveToMemory()
+    //////////////////////////////////////////////////////////////////////////
+    bool saveToFile(const std::string &filename, bool withLayout = true) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Replace the text, its character size and max width with a saved one,
+    // keeping the current font. The data must be 4-byte aligned, e.g. a
+    // memory-mapped file. It is validated, then copied into the lines in
+    // bulk, nothing is decoded. The saved layout is used as is if its font
+    // key matches the current font, otherwise the lines are laid out again.
+    // Returns false, leaving the text unchanged, if the data is invalid,
+    // e.g. a character size of 0 or above 4096, a negative max width, or a
+    // '\n' inside a line.
+    //////////////////////////////////////////////////////////////////////////
+    bool loadFromMemory(const void *data, std::size_t size);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Replace the text with a saved one, mapping the file in memory where
+    // the platform allows it, see loadFromMemory()
+    //////////////////////////////////////////////////////////////////////////
+    bool loadFromFile(const std::string &filename);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Set the width past which lines wrap, 0 for no wrapping (the default).
+    // Only the lines whose rows change are laid out again.
+    //////////////////////////////////////////////////////////////////////////
+    void setMaxWidth(float width);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Set the maximum number of lines, 0 for no limit (the default).
+    // When text is appended past the limit, the oldest lines are dropped
+    // and the remaining ones move up.
+    //////////////////////////////////////////////////////////////////////////
+    void setMaxLineCount(std::size_t count);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Set the maximum number of characters, 0 for no limit (the default).
+    // When text is appended past the limit, the oldest lines are dropped
+    // and the remaining ones move up. The last line is always kept.
+    //////////////////////////////////////////////////////////////////////////
+    void setMaxCharacterCount(std::size_t count);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Set the area to draw, in local coordinates. Only the lines in both
+    // this area and the view of the target are drawn. An empty rect, the
+    // default, draws every line in the view.
+    //////////////////////////////////////////////////////////////////////////
+    void setClipRect(const sf::FloatRect &rect);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Start a batch of edits. Until the matching endEdit(), the character
+    // setters don't lay out the edited lines, so line positions and bounds
+    // keep their previous state.
+    // Batches can be nested, only the outermost one has an effect.
+    //////////////////////////////////////////////////////////////////////////
+    void beginEdit();
+
+    //////////////////////////////////////////////////////////////////////////
+    // End a batch of edits, laying out each edited line once
+    //////////////////////////////////////////////////////////////////////////
+    void endEdit();
+
+    //////////////////////////////////////////////////////////////////////////
+    // Lay out every line and build the vertices now, instead of on the next
+    // draw or query. Once laid out, const member functions don't write
+    // anything until the text is changed again, so threads can draw and
+    // read the text at the same time.
+    //////////////////////////////////////////////////////////////////////////
+    void layout();
+
+    //////////////////////////////////////////////////////////////////////////
+    // Lay out several texts in parallel, on threadCount threads including
+    // the calling one. 0 uses one thread per core. Each text must only be
+    // in the list once, and not be used by other threads until this returns.
+    // The glyphs of every text are loaded into the font textures on the
+    // calling thread first, so like prewarm(), this needs an active OpenGL
+    // context there. Drawing, and the upload of the vertices, stay on the
+    // render thread.
+    //////////////////////////////////////////////////////////////////////////
+    static void layoutAll(const std::vector<RichText *> &texts, unsigned int threadCount = 0);
+
     //////////////////////////////////////////////////////////////////////////
     // Get the color of a character.
     // Attempting to access a character outside of the bounds causes a crash.
@@ -227,10 +902,146 @@ public:
     //////////////////////////////////////////////////////////////////////////
     sf::Uint32 getCharacter(std::size_t line, std::size_t pos) const;
 
+    //////////////////////////////////////////////////////////////////////////
+    // Get the number of lines
+    //////////////////////////////////////////////////////////////////////////
+    std::size_t getLineCount() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get a line
+    // Attempting to access a line outside of the bounds causes a crash.
+    // NOTE: Line positions are updated when lines are read, get the line
+    // again after an edit to read its position.
+    //////////////////////////////////////////////////////////////////////////
+    const Line &getLine(std::size_t index) const;
+
     //////////////////////////////////////////////////////////////////////////
     // Get text list
+    // NOTE: This used to return a std::vector. The container may change
+    // again, so prefer getLineCount() and getLine().
+    // NOTE: When old lines have been dropped, line positions don't start at
+    // zero but at the position of the first line. Like getLine(), this
+    // updates the line positions.
+    //////////////////////////////////////////////////////////////////////////
+    const std::pmr::deque<Line> &getLines() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Forget the glyph metrics cached for every font. Glyph advances,
+    // kerning and line spacing are cached by font and character size, and
+    // shared by every text. Call this after reloading a font, or before
+    // creating a font where a destroyed one used to be, while no other
+    // thread lays out or draws a text.
+    //////////////////////////////////////////////////////////////////////////
+    static void clearFontCache();
+
+    //////////////////////////////////////////////////////////////////////////
+    // Function called with the name and duration of a profiled scope, e.g.
+    // to feed a frame profiler
+    //////////////////////////////////////////////////////////////////////////
+    using ProfileCallback = void (*)(const char *scope, std::chrono::steady_clock::duration duration);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Set the function called at the end of laying out, building the
+    // vertices of and drawing a text, null for none. Scopes are only timed
+    // with SFE_RICHTEXT_STATS defined.
+    //////////////////////////////////////////////////////////////////////////
+    static void setProfileCallback(ProfileCallback callback);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Rasterise characters in glyph sets of a font ahead of time, e.g. at
+    // load time, so that the first frame showing them doesn't stall while
+    // sf::Font renders the glyphs and grows its texture. Like drawing,
+    // this needs an active OpenGL context.
+    //////////////////////////////////////////////////////////////////////////
+    static void prewarm(const sf::Font &font, std::u32string_view characters,
+                        const std::vector<GlyphSet> &glyphSets);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Rasterise UTF-8 characters in glyph sets of a font ahead of time
+    //////////////////////////////////////////////////////////////////////////
+    static void prewarm(const sf::Font &font, std::string_view characters,
+                        const std::vector<GlyphSet> &glyphSets);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the glyph sets the text is drawn with, sorted: the fill of every
+    // weight it uses, and the outline of every weight and thickness
+    //////////////////////////////////////////////////////////////////////////
+    std::vector<GlyphSet> getGlyphSets() const;
+
     //////////////////////////////////////////////////////////////////////////
-    const std::vector<Line> &getLines() const;
+    // Get the characters the text is drawn with, sorted, once each. Along
+    // with getGlyphSets(), this is what prewarm() needs to load the text.
+    //////////////////////////////////////////////////////////////////////////
+    std::u32string getCharacterSet() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the width past which lines wrap, 0 if they don't
+    //////////////////////////////////////////////////////////////////////////
+    float getMaxWidth() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the layout of every line, as plain data. Drawing uses the same
+    // positions.
+    //////////////////////////////////////////////////////////////////////////
+    RichTextLayout getLayout() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the maximum number of lines, 0 if there is no limit
+    //////////////////////////////////////////////////////////////////////////
+    std::size_t getMaxLineCount() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the maximum number of characters, 0 if there is no limit
+    //////////////////////////////////////////////////////////////////////////
+    std::size_t getMaxCharacterCount() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the number of characters of every line
+    //////////////////////////////////////////////////////////////////////////
+    std::size_t getCharacterCount() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the character at a point, in global coordinates, e.g. under the
+    // mouse. Points above or below the text give the first or last line.
+    // Lines, rows and characters are binary searched, so this is
+    // O(log lines + log characters).
+    //////////////////////////////////////////////////////////////////////////
+    RichTextPosition hitTest(sf::Vector2f point) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the box of a character in global coordinates, e.g. to place a
+    // caret or a tooltip. pos may be the length of the line.
+    // Attempting to access a character outside of the bounds causes a crash.
+    //////////////////////////////////////////////////////////////////////////
+    sf::FloatRect getCharacterRect(std::size_t line, std::size_t pos) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get an immutable copy of the laid out text, to be drawn by any number
+    // of RichTextInstance, e.g. identical labels. Later changes to the text
+    // don't affect the copy.
+    //////////////////////////////////////////////////////////////////////////
+    std::shared_ptr<const RichTextDocument> share() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the work done by the text since it was created, or since the
+    // stats were reset. Adds up the stats of every line.
+    //////////////////////////////////////////////////////////////////////////
+    RichTextStats getStats() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Reset the work counted so far
+    //////////////////////////////////////////////////////////////////////////
+    void resetStats();
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the area to draw, in local coordinates
+    //////////////////////////////////////////////////////////////////////////
+    const sf::FloatRect &getClipRect() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the memory resource of the text
+    //////////////////////////////////////////////////////////////////////////
+    std::pmr::memory_resource *getMemoryResource() const;
 
     //////////////////////////////////////////////////////////////////////////
     // Get character size
@@ -242,6 +1053,11 @@ public:
     //////////////////////////////////////////////////////////////////////////
     const sf::Font *getFont() const;
 
+    //////////////////////////////////////////////////////////////////////////
+    // Get the distance field font, null unless the text is drawn with one
+    //////////////////////////////////////////////////////////////////////////
+    const DistanceFieldFont *getDistanceFieldFont() const;
+
     //////////////////////////////////////////////////////////////////////////
     // Get local bounds
     //////////////////////////////////////////////////////////////////////////
@@ -262,27 +1078,315 @@ private:
     //////////////////////////////////////////////////////////////////////////
     // Delegate constructor
     //////////////////////////////////////////////////////////////////////////
-    RichText(const sf::Font *font);
+    RichText(const sf::Font *font, std::pmr::memory_resource *resource);
 
     //////////////////////////////////////////////////////////////////////////
-    // Creates a sf::Text instance using the current styles
+    // Creates an empty line using the current font and character size
     //////////////////////////////////////////////////////////////////////////
-    sf::Text createText(const sf::String &string) const;
+    Line createLine() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Append characters using the current styles, starting a new line on
+    // each '\n'
+    //////////////////////////////////////////////////////////////////////////
+    template <typename Iterator>
+    void appendLines(Iterator begin, Iterator end);
 
     //////////////////////////////////////////////////////////////////////////
     // Update geometry
     //////////////////////////////////////////////////////////////////////////
-    void updateGeometry() const;
+    void updateGeometry();
+
+    //////////////////////////////////////////////////////////////////////////
+    // Grow the bounds to include a line appended at the end, or characters
+    // appended to the last line, which was previousWidth wide before. A line
+    // that got narrower, e.g. because it wraps now, may have been the widest
+    // one, so the bounds are recomputed then.
+    //////////////////////////////////////////////////////////////////////////
+    void updateBounds(const Line &line, float previousWidth = 0.f);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Update the document after the layout of a line changed. Following
+    // lines move if its height changed, see setLineHeight(). Bounds are
+    // marked as outdated and the line vertices are rebuilt on next draw.
+    // During a batch of edits, the line is only remembered for endEdit().
+    //////////////////////////////////////////////////////////////////////////
+    void updateLineGeometry(std::size_t index);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Rebuild the vertices of a line on next draw
+    //////////////////////////////////////////////////////////////////////////
+    void invalidateLineVertices(std::size_t index);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Move the vertices of the lines from the given one to the end on next
+    // draw, once lines before them changed height or were added or removed.
+    // Only the lines whose vertices are outdated are rebuilt.
+    //////////////////////////////////////////////////////////////////////////
+    void moveVerticesFrom(std::size_t index);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Drop the oldest lines until the line and character limits are met
+    //////////////////////////////////////////////////////////////////////////
+    void evictLines();
+
+    //////////////////////////////////////////////////////////////////////////
+    // Update the document once lines after a line were replaced by added
+    // ones, e.g. when the line was split or joined with the next ones. Only
+    // the line and the added ones are laid out, the following lines keep
+    // their layout and vertices and only move.
+    //////////////////////////////////////////////////////////////////////////
+    void spliceLines(std::size_t index, std::size_t removed, std::size_t added);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Record the height of a line. The following lines move, their
+    // positions are updated when they are read, and their vertices are
+    // moved on next draw.
+    //////////////////////////////////////////////////////////////////////////
+    void setLineHeight(std::size_t index, float height);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Record the height of a line added at the end
+    //////////////////////////////////////////////////////////////////////////
+    void pushLineHeight(float height);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Lay out characters into plain data, one line at a time in a single
+    // reused Line, without a text. See measure().
+    //////////////////////////////////////////////////////////////////////////
+    template <typename Iterator>
+    static RichTextLayout measureLines(const sf::Font &font, Iterator begin, Iterator end,
+                                       unsigned int characterSize, float maxWidth);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Rasterise every glyph the text is drawn with, see prewarm()
+    //////////////////////////////////////////////////////////////////////////
+    void prewarmGlyphs() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Keep the work counted by a line that is about to be dropped
+    //////////////////////////////////////////////////////////////////////////
+    void collectStats(const Line &line);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Move every line, and the vertices that are up to date, up by the
+    // position of the first line, and forget the heights of the dropped
+    // lines, so that positions stay small however many lines have been
+    // dropped
+    //////////////////////////////////////////////////////////////////////////
+    void rebaseLines();
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the first line that ends below the given vertical position, in
+    // line coordinates, or the number of lines if there is none
+    //////////////////////////////////////////////////////////////////////////
+    std::size_t findLine(float y) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the vertical position of the first line
+    //////////////////////////////////////////////////////////////////////////
+    float getTop() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the vertical position of a line, in line coordinates, or the
+    // bottom of the last line for the number of lines
+    //////////////////////////////////////////////////////////////////////////
+    float getLineTop(std::size_t index) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Set the position of a line, if lines before it changed height
+    //////////////////////////////////////////////////////////////////////////
+    void placeLine(std::size_t index) const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Set the position of every line, if lines changed height
+    //////////////////////////////////////////////////////////////////////////
+    void placeLines() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Rebuild the sums of line heights if lines were added or removed in
+    // the middle
+    //////////////////////////////////////////////////////////////////////////
+    void ensureHeightTreeUpdate() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Rebuild the vertex array if the content, font or size changed, or
+    // only the vertices of the edited lines
+    //////////////////////////////////////////////////////////////////////////
+    void ensureGeometryUpdate() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Recompute the bounds if a line changed since they were last computed
+    //////////////////////////////////////////////////////////////////////////
+    void ensureBoundsUpdate() const;
 
     //////////////////////////////////////////////////////////////////////////
     // Member data
     //////////////////////////////////////////////////////////////////////////
-    mutable std::vector<Line> m_lines; ///< List of lines
-    const sf::Font *m_font;            ///< Font
-    unsigned int m_characterSize;      ///< Character size
-    mutable sf::FloatRect m_bounds;    ///< Local bounds
-    TextStroke m_currentStroke;        ///< Last used stroke
-    sf::Text::Style m_currentStyle;    ///< Last style used
+    mutable std::pmr::deque<Line> m_lines;          ///< List of lines
+    const sf::Font *m_font;                         ///< Font
+    const DistanceFieldFont *m_distanceField;       ///< Distance field atlas of the font, if drawn with one
+    unsigned int m_characterSize;                   ///< Character size
+    float m_maxWidth;                               ///< Width past which lines wrap, 0 for no wrapping
+    mutable sf::FloatRect m_bounds;                 ///< Local bounds
+    TextStroke m_currentStroke;                     ///< Last used stroke
+    sf::Text::Style m_currentStyle;                 ///< Last style used
+    mutable std::pmr::vector<sf::Vertex> m_vertices; ///< Glyph quads of every line
+    mutable std::pmr::vector<sf::Vertex> m_movedVertices; ///< Vertices being moved or rebuilt, kept to reuse their storage
+    mutable bool m_geometryNeedUpdate;              ///< Does the vertex array need to be rebuilt?
+    mutable std::pmr::vector<std::size_t> m_dirtyLines; ///< Lines whose vertices need to be rebuilt
+    mutable std::size_t m_firstMovedLine;           ///< First line whose vertices, and the following ones, may need to be moved
+    mutable std::size_t m_firstVertex;              ///< First vertex of the first line, previous ones belong to dropped lines
+    mutable bool m_boundsNeedUpdate;                ///< Do the bounds need to be recomputed?
+    std::pmr::vector<float> m_lineHeights;          ///< Height of every line, after those of the dropped lines
+    std::size_t m_firstLineSlot;                    ///< Index of the height of the first line
+    mutable std::pmr::vector<double> m_heightTree;  ///< Fenwick tree of the line heights, to find the position of a line
+    mutable bool m_heightTreeNeedUpdate;            ///< Does the height tree need to be rebuilt?
+    mutable bool m_linePositionsNeedUpdate;         ///< Do the line positions need to be updated?
+    unsigned int m_editDepth;                       ///< Number of nested batches of edits
+    std::pmr::vector<std::size_t> m_editedLines;    ///< Lines edited during the current batch
+    std::size_t m_maxLineCount;                     ///< Maximum number of lines, 0 for no limit
+    std::size_t m_maxCharacterCount;                ///< Maximum number of characters, 0 for no limit
+    std::size_t m_characterCount;                   ///< Number of characters of every line
+    sf::FloatRect m_clipRect;                       ///< Area to draw, in local coordinates
+    mutable RichTextStats m_stats;                  ///< Work done by the text, and by its dropped lines
+
+    friend RichTextLayout measure(const sf::Font &font, std::u32string_view string,
+                                  unsigned int characterSize, float maxWidth);
+    friend RichTextLayout measure(const sf::Font &font, std::string_view string,
+                                  unsigned int characterSize, float maxWidth);
 };
 
+//////////////////////////////////////////////////////////////////////////////
+// Laid out text that can't be changed, shared by the instances drawing it.
+// Created by RichText::share(). The font must outlive it.
+//////////////////////////////////////////////////////////////////////////////
+class RichTextDocument
+{
+public:
+    //////////////////////////////////////////////////////////////////////////
+    // Get local bounds
+    //////////////////////////////////////////////////////////////////////////
+    const sf::FloatRect &getLocalBounds() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the number of vertices drawn per instance
+    //////////////////////////////////////////////////////////////////////////
+    std::size_t getVertexCount() const;
+
+private:
+    //////////////////////////////////////////////////////////////////////////
+    // Constructor
+    //////////////////////////////////////////////////////////////////////////
+    RichTextDocument();
+
+    //////////////////////////////////////////////////////////////////////////
+    // Member data
+    //////////////////////////////////////////////////////////////////////////
+    std::vector<sf::Vertex> m_vertices;             ///< Glyph quads of every line, in local coordinates
+    sf::FloatRect m_bounds;                         ///< Local bounds
+    const sf::Font *m_font;                         ///< Font
+    const DistanceFieldFont *m_distanceField;       ///< Distance field atlas of the font, if drawn with one
+    unsigned int m_characterSize;                   ///< Character size
+
+    friend class RichText;
+    friend class RichTextInstance;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Shared document drawn with its own transform and tint. Copying an
+// instance doesn't copy the document.
+//////////////////////////////////////////////////////////////////////////////
+class RichTextInstance : public sf::Drawable, public sf::Transformable
+{
+public:
+    //////////////////////////////////////////////////////////////////////////
+    // Constructor
+    //////////////////////////////////////////////////////////////////////////
+    RichTextInstance();
+
+    //////////////////////////////////////////////////////////////////////////
+    // Constructor
+    //////////////////////////////////////////////////////////////////////////
+    explicit RichTextInstance(std::shared_ptr<const RichTextDocument> document);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Set the document to draw, null for none
+    //////////////////////////////////////////////////////////////////////////
+    void setDocument(std::shared_ptr<const RichTextDocument> document);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Set the color the document is multiplied by, white (the default)
+    // draws it as is
+    //////////////////////////////////////////////////////////////////////////
+    void setColor(const sf::Color &color);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the document to draw
+    //////////////////////////////////////////////////////////////////////////
+    const std::shared_ptr<const RichTextDocument> &getDocument() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get the color the document is multiplied by
+    //////////////////////////////////////////////////////////////////////////
+    const sf::Color &getColor() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get local bounds
+    //////////////////////////////////////////////////////////////////////////
+    sf::FloatRect getLocalBounds() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Get global bounds
+    //////////////////////////////////////////////////////////////////////////
+    sf::FloatRect getGlobalBounds() const;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Draw several instances in order, in as few draw calls as possible.
+    // Consecutive instances drawn with the same glyph texture, i.e. the
+    // same font and character size, or the same distance field font, are
+    // transformed and tinted on the CPU into a single call. Instances
+    // outside of the view are skipped.
+    //////////////////////////////////////////////////////////////////////////
+    static void drawAll(sf::RenderTarget &target, const std::vector<const RichTextInstance *> &instances,
+                        sf::RenderStates states = sf::RenderStates::Default);
+
+protected:
+    //////////////////////////////////////////////////////////////////////////
+    // Draw. Untinted instances draw the vertices of the document as is.
+    //////////////////////////////////////////////////////////////////////////
+    void draw(sf::RenderTarget &target, sf::RenderStates states) const override;
+
+private:
+    //////////////////////////////////////////////////////////////////////////
+    // Draw count instances, see drawAll()
+    //////////////////////////////////////////////////////////////////////////
+    static void drawAll(sf::RenderTarget &target, const RichTextInstance *const *instances,
+                        std::size_t count, sf::RenderStates states);
+
+    //////////////////////////////////////////////////////////////////////////
+    // Member data
+    //////////////////////////////////////////////////////////////////////////
+    std::shared_ptr<const RichTextDocument> m_document; ///< Document to draw
+    sf::Color m_color;                              ///< Color the document is multiplied by
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// Lay out text with a font and a character size, without drawing it, e.g.
+// to find the size of a label. Lines wrap past maxWidth, unless it is 0.
+// No text or vertices are built, lines are laid out one at a time.
+// NOTE: sf::Font only gives the advance of a glyph along with the glyph, so
+// the glyphs measured are still rasterised into its texture, which needs an
+// OpenGL context. Rasterise them with RichText::prewarm() on the main
+// thread first, and measuring from other threads only reads the caches.
+//////////////////////////////////////////////////////////////////////////////
+RichTextLayout measure(const sf::Font &font, std::u32string_view string,
+                       unsigned int characterSize, float maxWidth = 0.f);
+
+//////////////////////////////////////////////////////////////////////////////
+// Lay out UTF-8 text with a font and a character size, without drawing it
+//////////////////////////////////////////////////////////////////////////////
+RichTextLayout measure(const sf::Font &font, std::string_view string,
+                       unsigned int characterSize, float maxWidth = 0.f);
+
 }
@@ -0,0 +1,17 @@
+TEMPLATE = app
+CONFIG -= qt
+CONFIG -= app_bundle
+CONFIG += console
+CONFIG += c++17
+CONFIG += thread
+CONFIG += release
+
+INCLUDEPATH += SFML
+
+LIBS += -lsfml-graphics -lsfml-window -lsfml-system
+
+SOURCES += main.cpp \
+    ../RichText.cpp
+
+HEADERS += \
+    ../RichText.hpp
@@ -0,0 +1,473 @@
+#include <SFML/Graphics.hpp>
+#include "../RichText.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Run a case until it has taken long enough to time, and print the time
+// of one of its operations
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+void run(const std::string &name, std::size_t operations, F function)
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::size_t iterations = 0;
+    Clock::duration elapsed = Clock::duration::zero();
+    do
+    {
+        Clock::time_point start = Clock::now();
+        function();
+        elapsed += Clock::now() - start;
+        ++iterations;
+    }
+    while (elapsed < std::chrono::milliseconds(200));
+
+    double nanoseconds = std::chrono::duration<double, std::nano>(elapsed).count();
+    std::printf("%-52s %12.1f ns/op %12zu ops\n", name.c_str(),
+                nanoseconds / (iterations * operations), iterations * operations);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Memory resource counting the bytes it holds and the allocations it made
+////////////////////////////////////////////////////////////////////////////////
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+    std::size_t getAllocated() const { return m_allocated; }
+    std::size_t getAllocationCount() const { return m_allocationCount; }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        m_allocated += bytes;
+        ++m_allocationCount;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *pointer, std::size_t bytes, std::size_t alignment) override
+    {
+        m_allocated -= bytes;
+        std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    std::size_t m_allocated = 0;
+    std::size_t m_allocationCount = 0;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Render target counting and discarding draw calls, so that building and
+// batching vertices is timed without an OpenGL context. sf::RenderTarget
+// only issues OpenGL calls once it could activate itself, which this target
+// refuses to do.
+////////////////////////////////////////////////////////////////////////////////
+class NullTarget : public sf::RenderTarget
+{
+public:
+    NullTarget() { initialize(); }
+
+    sf::Vector2u getSize() const override { return sf::Vector2u(1024, 768); }
+
+    std::size_t getDrawCount() const { return m_drawCount; }
+
+#if SFML_VERSION_MAJOR > 2 || SFML_VERSION_MINOR >= 5
+    bool setActive(bool active = true) override
+    {
+        if (active)
+            ++m_drawCount;
+        return false;
+    }
+#endif
+
+private:
+#if SFML_VERSION_MAJOR == 2 && SFML_VERSION_MINOR < 5
+    bool activate(bool active) override
+    {
+        if (active)
+            ++m_drawCount;
+        return false;
+    }
+#endif
+
+    std::size_t m_drawCount = 0;
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Append lines made of runs of 8 characters, alternating colors and styles
+////////////////////////////////////////////////////////////////////////////////
+void fill(sfe::RichText &text, std::size_t lines, std::size_t runs)
+{
+    static const sf::Color colors[] = { sf::Color::White, sf::Color::Cyan, sf::Color::Yellow };
+    static const sf::Text::Style styles[] = { sf::Text::Regular, sf::Text::Bold, sf::Text::Italic };
+
+    for (std::size_t line = 0; line < lines; ++line)
+    {
+        for (std::size_t run = 0; run < runs; ++run)
+            text << colors[run % 3] << styles[run % 3] << "Lorem ip";
+
+        if (line + 1 < lines)
+            text << "\n";
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void benchmarkAppend(const sf::Font &font)
+{
+    run("append <<, 1000 runs of 8 characters", 8000, [&]
+    {
+        sfe::RichText text(font);
+        fill(text, 1, 1000);
+    });
+
+    std::string string(8000, 'a');
+    for (std::size_t i = 80; i < string.size(); i += 81)
+        string[i] = '\n';
+
+    run("append UTF-8, 100 lines of 80 characters", string.size(), [&]
+    {
+        sfe::RichText text(font);
+        text.append(string);
+    });
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void benchmarkEdits(const sf::Font &font)
+{
+    const std::size_t length = 10000;
+    const std::size_t edits = 1000;
+
+    std::mt19937 random(42);
+    std::uniform_int_distribution<std::size_t> position(0, length - 1);
+
+    sfe::RichText text(font);
+    text << std::string(length, 'a');
+
+    run("setCharacterColor, 1 line of 10000 characters", edits, [&]
+    {
+        for (std::size_t i = 0; i < edits; ++i)
+            text.setCharacterColor(0, position(random), i % 2 ? sf::Color::Red : sf::Color::White);
+    });
+
+    run("setCharacterStyle, 1 line of 10000 characters", edits, [&]
+    {
+        for (std::size_t i = 0; i < edits; ++i)
+            text.setCharacterStyle(0, position(random), i % 2 ? sf::Text::Bold : sf::Text::Regular);
+    });
+
+    run("setCharacter, 1 line of 10000 characters", edits, [&]
+    {
+        for (std::size_t i = 0; i < edits; ++i)
+            text.setCharacter(0, position(random), i % 2 ? U'b' : U'a');
+    });
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void benchmarkLookups(const sf::Font &font)
+{
+    const std::size_t lookups = 1000;
+
+    for (std::size_t runs : { 1, 100, 1000 })
+    {
+        sfe::RichText text(font);
+        fill(text, 1, runs);
+
+        const sfe::RichText::Line &line = text.getLine(0);
+        std::mt19937 random(42);
+        std::uniform_int_distribution<std::size_t> position(0, line.getLength() - 1);
+
+        unsigned int sum = 0;
+        run("getCharacterColor, 1 line of " + std::to_string(runs) + " runs", lookups, [&]
+        {
+            for (std::size_t i = 0; i < lookups; ++i)
+                sum += text.getCharacterColor(0, position(random)).r;
+        });
+
+        run("Line::getLength, 1 line of " + std::to_string(runs) + " runs", lookups, [&]
+        {
+            for (std::size_t i = 0; i < lookups; ++i)
+                sum += static_cast<unsigned int>(line.getLength());
+        });
+
+        // Keep the lookups from being optimized away
+        if (sum == 1)
+            std::printf(" ");
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Lay out and build the vertices of every line again, as a change of
+// character size does
+////////////////////////////////////////////////////////////////////////////////
+void benchmarkLayout(const sf::Font &font)
+{
+    for (std::size_t lines : { 10, 100, 1000 })
+    {
+        for (std::size_t runs : { 1, 10, 100 })
+        {
+            sfe::RichText text(font);
+            fill(text, lines, runs);
+
+            unsigned int size = 30;
+            run("layout, " + std::to_string(lines) + " lines of " + std::to_string(runs) + " runs", 1, [&]
+            {
+                size = size == 30 ? 31 : 30;
+                text.setCharacterSize(size);
+                text.layout();
+            });
+        }
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Load a saved text, with and without its layout, against building it again
+////////////////////////////////////////////////////////////////////////////////
+void benchmarkLoad(const sf::Font &font)
+{
+    sfe::RichText source(font);
+    fill(source, 1000, 10);
+
+    std::vector<sf::Uint8> laidOut;
+    std::vector<sf::Uint8> bare;
+    source.saveToMemory(laidOut);
+    source.saveToMemory(bare, false);
+
+    sfe::RichText text(font);
+    run("build and layout, 1000 lines of 10 runs", 1, [&]
+    {
+        text.clear();
+        fill(text, 1000, 10);
+        text.layout();
+    });
+
+    run("load and layout, 1000 lines of 10 runs", 1, [&]
+    {
+        text.loadFromMemory(bare.data(), bare.size());
+        text.layout();
+    });
+
+    run("load laid out, 1000 lines of 10 runs", 1, [&]
+    {
+        text.loadFromMemory(laidOut.data(), laidOut.size());
+        text.layout();
+    });
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Memory held by the lines, runs, layout and vertices of a text, once laid
+// out, not counting the RichText object itself
+////////////////////////////////////////////////////////////////////////////////
+void benchmarkMemory(const sf::Font &font)
+{
+    for (std::size_t runs : { 1, 10, 100 })
+    {
+        CountingResource resource;
+        sfe::RichText text(font, &resource);
+        fill(text, 100, runs);
+        text.layout();
+
+        std::string name = "memory, 100 lines of " + std::to_string(runs) + " runs";
+        std::printf("%-52s %12.1f B/char\n", name.c_str(),
+                    static_cast<double>(resource.getAllocated()) / text.getCharacterCount());
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Allocations made by the text when building its vertices for the first
+// time, with and without reserve(), and when an edited line is laid out
+// again. Glyph caches shared by every text aren't counted.
+////////////////////////////////////////////////////////////////////////////////
+void benchmarkAllocations(const sf::Font &font)
+{
+    for (bool reserve : { false, true })
+    {
+        CountingResource resource;
+        sfe::RichText text(font, &resource);
+        if (reserve)
+            text.reserve(100, 100 * 40);
+        fill(text, 100, 5);
+
+        std::string suffix = reserve ? ", after reserve()" : "";
+        std::size_t count = resource.getAllocationCount();
+        text.layout();
+        std::printf("%-52s %12zu allocs\n", ("first layout, 100 lines of 5 runs" + suffix).c_str(),
+                    resource.getAllocationCount() - count);
+
+        count = resource.getAllocationCount();
+        text.setCharacterColor(50, 3, sf::Color::Red);
+        text.layout();
+        std::printf("%-52s %12zu allocs\n", ("edit and layout, 100 lines of 5 runs" + suffix).c_str(),
+                    resource.getAllocationCount() - count);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+void benchmarkDraw(const sf::Font &font, sf::RenderTarget &target, const std::string &suffix)
+{
+    for (std::size_t lines : { 100, 1000 })
+    {
+        sfe::RichText text(font);
+        fill(text, lines, 10);
+        target.draw(text);
+
+        run("draw, " + std::to_string(lines) + " lines of 10 runs" + suffix, 1, [&]
+        {
+            target.draw(text);
+        });
+
+        std::size_t line = 0;
+        run("edit and draw, " + std::to_string(lines) + " lines of 10 runs" + suffix, 1, [&]
+        {
+            line = (line + 1) % lines;
+            text.setCharacterColor(line, 0, line % 2 ? sf::Color::Red : sf::Color::White);
+            target.draw(text);
+        });
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Lay out 1000 copies of a label in a grid, as texts of their own and as
+// instances of a shared document
+////////////////////////////////////////////////////////////////////////////////
+void makeLabels(const sf::Font &font, std::deque<sfe::RichText> &texts,
+                std::vector<sfe::RichTextInstance> &instances)
+{
+    sfe::RichText label(font);
+    fill(label, 1, 2);
+    std::shared_ptr<const sfe::RichTextDocument> document = label.share();
+
+    for (std::size_t i = 0; i < 1000; ++i)
+    {
+        sf::Vector2f position(static_cast<float>(i % 40) * 25.f, static_cast<float>(i / 40) * 30.f);
+
+        texts.emplace_back(font);
+        fill(texts.back(), 1, 2);
+        texts.back().setPosition(position);
+
+        instances.emplace_back(document);
+        instances.back().setPosition(position);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Draw many copies of a label, as texts of their own and as instances of a
+// shared document
+////////////////////////////////////////////////////////////////////////////////
+void benchmarkInstances(const sf::Font &font, sf::RenderTarget &target, const std::string &suffix)
+{
+    std::deque<sfe::RichText> texts;
+    std::vector<sfe::RichTextInstance> instances;
+    makeLabels(font, texts, instances);
+
+    std::vector<const sfe::RichTextInstance *> batch;
+    for (const sfe::RichTextInstance &instance : instances)
+        batch.push_back(&instance);
+
+    run("draw, 1000 labels as texts" + suffix, 1, [&]
+    {
+        for (const sfe::RichText &text : texts)
+            target.draw(text);
+    });
+
+    run("draw, 1000 labels as instances" + suffix, 1, [&]
+    {
+        for (const sfe::RichTextInstance &instance : instances)
+            target.draw(instance);
+    });
+
+    run("drawAll, 1000 labels as instances" + suffix, 1, [&]
+    {
+        sfe::RichTextInstance::drawAll(target, batch);
+    });
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Draw calls made by one frame of many copies of a label, drawn one by one
+// or batched
+////////////////////////////////////////////////////////////////////////////////
+void benchmarkDrawCalls(const sf::Font &font)
+{
+    std::deque<sfe::RichText> texts;
+    std::vector<sfe::RichTextInstance> instances;
+    makeLabels(font, texts, instances);
+
+    std::vector<const sfe::RichTextInstance *> batch;
+    for (const sfe::RichTextInstance &instance : instances)
+        batch.push_back(&instance);
+
+    NullTarget target;
+    for (const sfe::RichText &text : texts)
+        target.draw(text);
+    std::printf("%-52s %12zu calls\n", "draw, 1000 labels as texts", target.getDrawCount());
+
+    std::size_t count = target.getDrawCount();
+    for (const sfe::RichTextInstance &instance : instances)
+        target.draw(instance);
+    std::printf("%-52s %12zu calls\n", "draw, 1000 labels as instances", target.getDrawCount() - count);
+
+    count = target.getDrawCount();
+    sfe::RichTextInstance::drawAll(target, batch);
+    std::printf("%-52s %12zu calls\n", "drawAll, 1000 labels as instances", target.getDrawCount() - count);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    sf::Font font;
+    if (!font.loadFromFile(argc > 1 ? argv[1] : "FreeMono.ttf"))
+        return 1;
+
+    benchmarkAppend(font);
+    benchmarkEdits(font);
+    benchmarkLookups(font);
+    benchmarkLayout(font);
+    benchmarkLoad(font);
+    benchmarkMemory(font);
+    benchmarkAllocations(font);
+
+    // Building and batching vertices is timed without drawing them
+    NullTarget target;
+    benchmarkDraw(font, target, "");
+    benchmarkInstances(font, target, "");
+    benchmarkDrawCalls(font);
+
+    // Drawing them too needs an OpenGL context; headless, run under Xvfb or
+    // an EGL-backed SFML build
+    sf::RenderTexture texture;
+    if (texture.create(1024, 768))
+    {
+        benchmarkDraw(font, texture, ", OpenGL");
+        benchmarkInstances(font, texture, ", OpenGL");
+    }
+    else
+        std::printf("OpenGL draw benchmarks skipped, no OpenGL context\n");
+}
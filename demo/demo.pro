@@ -2,7 +2,8 @@ TEMPLATE = app
 CONFIG -= qt
 CONFIG -= app_bundle
 CONFIG -= console
-CONFIG += C++11
+CONFIG += c++17
+CONFIG += thread
 
 INCLUDEPATH += SFML
 
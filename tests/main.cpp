@@ -0,0 +1,164 @@
+#include <SFML/Graphics.hpp>
+#include "../RichText.hpp"
+
+#include <cstdio>
+#include <memory_resource>
+#include <string>
+#include <utility>
+
+namespace
+{
+
+////////////////////////////////////////////////////////////////////////////////
+// Memory resource counting the allocations it made
+////////////////////////////////////////////////////////////////////////////////
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+    std::size_t getAllocationCount() const { return m_allocationCount; }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        ++m_allocationCount;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *pointer, std::size_t bytes, std::size_t alignment) override
+    {
+        std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    std::size_t m_allocationCount = 0;
+};
+
+
+std::size_t failures = 0;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Print the result of a check, and count the failed ones
+////////////////////////////////////////////////////////////////////////////////
+void check(bool passed, const std::string &name)
+{
+    std::printf("%-60s %s\n", name.c_str(), passed ? "ok" : "FAILED");
+    if (!passed)
+        ++failures;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Append lines made of runs of 8 characters, alternating colors and styles
+////////////////////////////////////////////////////////////////////////////////
+void fill(sfe::RichText &text, std::size_t lines, std::size_t runs)
+{
+    static const sf::Color colors[] = { sf::Color::White, sf::Color::Cyan, sf::Color::Yellow };
+    static const sf::Text::Style styles[] = { sf::Text::Regular, sf::Text::Bold, sf::Text::Italic };
+
+    for (std::size_t line = 0; line < lines; ++line)
+    {
+        for (std::size_t run = 0; run < runs; ++run)
+            text << colors[run % 3] << styles[run % 3] << "Lorem ip";
+
+        if (line + 1 < lines)
+            text << "\n";
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Building the vertices of a text whose storage was reserved allocates
+// nothing
+////////////////////////////////////////////////////////////////////////////////
+void testLayoutAfterReserve(const sf::Font &font)
+{
+    CountingResource resource;
+    sfe::RichText text(font, &resource);
+    text.reserve(100, 100 * 40);
+    fill(text, 100, 5);
+
+    std::size_t count = resource.getAllocationCount();
+    text.layout();
+    check(resource.getAllocationCount() == count, "layout() after reserve() allocates nothing");
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Changing the color of a whole run keeps the runs as they are, and only
+// rebuilds the vertices of its line in place
+////////////////////////////////////////////////////////////////////////////////
+void testColorEdit(const sf::Font &font)
+{
+    CountingResource resource;
+    sfe::RichText text(font, &resource);
+    text.reserve(100, 100 * 40);
+    fill(text, 100, 5);
+    text.layout();
+
+    // The second run of a line is made of its characters 8 to 16
+    std::size_t count = resource.getAllocationCount();
+    text.setCharacterColor(50, 8, 16, sf::Color::Red);
+    text.layout();
+    check(resource.getAllocationCount() == count, "color edit and layout() allocate nothing");
+    check(text.getCharacterColor(50, 8) == sf::Color::Red && text.getLine(50).getRuns().size() == 5,
+          "color edit keeps the runs");
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Moving or swapping lines, or texts sharing a memory resource, takes their
+// storage instead of copying it
+////////////////////////////////////////////////////////////////////////////////
+void testMoves(const sf::Font &font)
+{
+    CountingResource resource;
+    sfe::RichText text(font, &resource);
+    fill(text, 100, 5);
+    text.layout();
+
+    sfe::RichText::Line line(text.getLine(0), &resource);
+    sfe::RichText::Line other(text.getLine(1), &resource);
+
+    std::size_t count = resource.getAllocationCount();
+    sfe::RichText::Line moved(std::move(line));
+    line = std::move(other);
+    std::swap(line, moved);
+    check(resource.getAllocationCount() == count, "moving and swapping lines allocates nothing");
+
+    // A std::deque may allocate the empty block list of the text it is moved
+    // from, like an empty text does. Copying any line would allocate more.
+    count = resource.getAllocationCount();
+    sfe::RichText empty(font, &resource);
+    std::size_t emptyCount = resource.getAllocationCount() - count;
+
+    count = resource.getAllocationCount();
+    sfe::RichText movedText(std::move(text));
+    check(resource.getAllocationCount() - count <= emptyCount, "moving a text copies nothing");
+
+    sfe::RichText otherText(font, &resource);
+    fill(otherText, 10, 5);
+    count = resource.getAllocationCount();
+    std::swap(movedText, otherText);
+    check(resource.getAllocationCount() - count <= 3 * emptyCount, "swapping texts copies nothing");
+    check(movedText.getLineCount() == 10 && otherText.getLineCount() == 100, "swapped texts keep their lines");
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    sf::Font font;
+    if (!font.loadFromFile(argc > 1 ? argv[1] : "FreeMono.ttf"))
+        return 1;
+
+    testLayoutAfterReserve(font);
+    testColorEdit(font);
+    testMoves(font);
+
+    return failures == 0 ? 0 : 1;
+}